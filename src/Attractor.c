@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "Attractor.h"
+
+// defaults of settings a definition leaves out, those of the built-ins
+#define DEFAULTSCALEFACTOR 40.0f
+#define DEFAULTVOLSIZE 40.0f
+#define MAXLINELENGTH 1024
+
+
+
+static void initDefinition(attractorDefinition *def, const char *name)
+{
+	memset(def, 0, sizeof(attractorDefinition));
+	snprintf(def->name, MAXATTRACTORNAME, "%s", name);
+	def->scaleFactor = DEFAULTSCALEFACTOR;
+	def->translation[2] = -0.5f;
+	def->volSize = DEFAULTVOLSIZE;
+}
+
+
+
+void attractorSetDegree(attractorParameters *params)
+{
+	params->degree = 0;
+	for(unsigned int i = 0; i < NPARAMETERS; i++) {
+		if(params->X[i] == 0.0f && params->Y[i] == 0.0f && params->Z[i] == 0.0f) continue;
+		unsigned int degree = (i == 0) ? 0 : (i < 4) ? 1 : (i < NQUADRATIC) ? 2 : 3;
+		if(degree > params->degree) params->degree = degree;
+	}
+}
+
+
+
+void attractorLibraryBuiltin(attractorLibrary *lib)
+{
+	memset(lib, 0, sizeof(attractorLibrary));
+	lib->n = 3;
+	attractorDefinition *a = lib->attractors;
+
+	// Lorenz
+	initDefinition(&a[0], "Lorenz");
+	a[0].params.X[1] = -10.0f;
+	a[0].params.X[2] = 10.0f;
+	a[0].params.Y[1] = 28.0f;
+	a[0].params.Y[2] = -1.0f;
+	a[0].params.Y[6] = -1.0f;
+	a[0].params.Z[3] = -8.0f/3.0f;
+	a[0].params.Z[5] = 1.0f;
+
+	// Roessler
+	initDefinition(&a[1], "Roessler");
+	a[1].params.X[2] = -1.0f;
+	a[1].params.X[3] = -1.0f;
+	a[1].params.Y[1] = 1.0f;
+	a[1].params.Y[2] = 0.1f;
+	a[1].params.Z[0] = 0.1f;
+	a[1].params.Z[3] = -14.0f;
+	a[1].params.Z[6] = 1.0f;
+
+	// Lu Chen
+	initDefinition(&a[2], "Lu Chen");
+	a[2].params.X[1] = -36.0f;
+	a[2].params.X[2] = 36.0f;
+	a[2].params.Y[0] = 7.0f;
+	a[2].params.Y[1] = 1.0f;
+	a[2].params.Y[2] = 20.0f;
+	a[2].params.Y[6] = -1.0f;
+	a[2].params.Z[3] = -3.0f;
+	a[2].params.Z[5] = 1.0f;
+
+	for(unsigned int i = 0; i < lib->n; i++) attractorSetDegree(&(a[i].params));
+}
+
+
+
+// Index of the term x^px y^py z^pz in the order of NPARAMETERS
+static unsigned int termIndex(unsigned int px, unsigned int py, unsigned int pz)
+{
+	unsigned int index = 0;
+	for(unsigned int d = 0; d <= MAXDEGREE; d++) {
+		for(int a = d; a >= 0; a--) {
+			for(int b = d-a; b >= 0; b--) {
+				if((unsigned int)a == px && (unsigned int)b == py && d-a-b == pz) return index;
+				index++;
+			}
+		}
+	}
+	return index;
+}
+
+
+
+static const char *skipSpace(const char *s)
+{
+	while(*s == ' ' || *s == '\t') s++;
+	return s;
+}
+
+
+
+// A sum of terms such as "28*x - y - x*z" or "-2.5 x^2 y", as coefficients of the
+// NPARAMETERS terms. Returns NULL on success, otherwise what is wrong.
+static const char *parsePolynomial(const char *s, float *coefficients)
+{
+	for(unsigned int i = 0; i < NPARAMETERS; i++) coefficients[i] = 0.0f;
+	s = skipSpace(s);
+	if(*s == '\0') return "empty polynomial";
+	unsigned int first = 1;
+	while(*s != '\0') {
+		float sign = 1.0f;
+		if(*s == '+' || *s == '-') {
+			if(*s == '-') sign = -1.0f;
+			s = skipSpace(s+1);
+		}
+		else if(!first) return "expected + or - between terms";
+		first = 0;
+
+		float coefficient = 1.0f;
+		unsigned int hasNumber = 0;
+		if((*s >= '0' && *s <= '9') || *s == '.') {
+			char *end;
+			coefficient = strtof(s, &end);
+			s = skipSpace(end);
+			hasNumber = 1;
+			if(*s == '*') s = skipSpace(s+1);
+		}
+
+		unsigned int power[3] = {0, 0, 0};
+		unsigned int hasVariable = 0;
+		while(*s == 'x' || *s == 'y' || *s == 'z') {
+			unsigned int v = *s - 'x';
+			unsigned int p = 1;
+			s = skipSpace(s+1);
+			if(*s == '^') {
+				s = skipSpace(s+1);
+				if(*s < '0' || *s > '9') return "expected a power after ^";
+				p = strtoul(s, (char**)&s, 10);
+				s = skipSpace(s);
+			}
+			power[v] += p;
+			hasVariable = 1;
+			if(*s == '*') s = skipSpace(s+1);
+		}
+		if(!hasNumber && !hasVariable) return "expected a number or x, y, z";
+		if(power[0] + power[1] + power[2] > MAXDEGREE) return "term of degree above 3";
+		coefficients[termIndex(power[0], power[1], power[2])] += sign*coefficient;
+	}
+	return NULL;
+}
+
+
+
+// Whitespace separated floats, exactly n of them. Returns NULL on success.
+static const char *parseFloats(const char *s, float *values, unsigned int n)
+{
+	for(unsigned int i = 0; i < n; i++) {
+		char *end;
+		values[i] = strtof(s, &end);
+		if(end == s) return (n == 1) ? "expected a number" : "too few numbers";
+		s = end;
+	}
+	s = skipSpace(s);
+	if(*s != '\0') return "unexpected text after the value";
+	return NULL;
+}
+
+
+
+int attractorLibraryLoad(attractorLibrary *lib, const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL) {
+		fprintf(stderr, "Error opening attractor definitions %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	struct stat st;
+	fstat(fileno(fp), &st);
+
+	attractorLibrary *loaded = (attractorLibrary*)calloc(1, sizeof(attractorLibrary));
+	if(loaded == NULL) {
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+	loaded->modified = st.st_mtim;
+
+	char line[MAXLINELENGTH];
+	unsigned int lineNumber = 0;
+	const char *error = NULL;
+	attractorDefinition *def = NULL;
+	while(error == NULL && fgets(line, MAXLINELENGTH, fp) != NULL) {
+		lineNumber++;
+		// strip the comment and trailing space
+		line[strcspn(line, "#\r\n")] = '\0';
+		size_t length = strlen(line);
+		while(length > 0 && (line[length-1] == ' ' || line[length-1] == '\t')) line[--length] = '\0';
+		const char *s = skipSpace(line);
+		if(*s == '\0') continue;
+
+		if(*s == '[') {
+			const char *close = strchr(s, ']');
+			if(close == NULL || close[1] != '\0') error = "expected [name]";
+			else if(loaded->n == MAXATTRACTORS) error = "too many attractors";
+			else {
+				def = &(loaded->attractors[loaded->n++]);
+				initDefinition(def, "");
+				size_t nameLength = close - (s+1);
+				if(nameLength >= MAXATTRACTORNAME) nameLength = MAXATTRACTORNAME-1;
+				memcpy(def->name, s+1, nameLength);
+				def->name[nameLength] = '\0';
+			}
+			continue;
+		}
+
+		const char *equals = strchr(s, '=');
+		if(equals == NULL) {
+			error = "expected key = value";
+			continue;
+		}
+		if(def == NULL) {
+			error = "setting before the first [name]";
+			continue;
+		}
+		size_t keyLength = equals - s;
+		while(keyLength > 0 && (s[keyLength-1] == ' ' || s[keyLength-1] == '\t')) keyLength--;
+		const char *value = skipSpace(equals+1);
+#define KEY(k) (keyLength == strlen(k) && !strncmp(s, k, keyLength))
+		if(KEY("dx")) error = parsePolynomial(value, def->params.X);
+		else if(KEY("dy")) error = parsePolynomial(value, def->params.Y);
+		else if(KEY("dz")) error = parsePolynomial(value, def->params.Z);
+		else if(KEY("step")) error = parseFloats(value, &(def->stepSize), 1);
+		else if(KEY("scale")) error = parseFloats(value, &(def->scaleFactor), 1);
+		else if(KEY("translation")) error = parseFloats(value, def->translation, 3);
+		else if(KEY("volume")) error = parseFloats(value, &(def->volSize), 1);
+		else error = "unknown key";
+#undef KEY
+		if(error == NULL && (def->scaleFactor <= 0.0f || def->volSize <= 0.0f || def->stepSize < 0.0f)) {
+			error = "value must be positive";
+		}
+	}
+	fclose(fp);
+
+	if(error == NULL && loaded->n == 0) error = "no attractors";
+	if(error != NULL) {
+		fprintf(stderr, "Error in %s, line %u: %s\n", filename, lineNumber, error);
+		free(loaded);
+		return EXIT_FAILURE;
+	}
+	for(unsigned int i = 0; i < loaded->n; i++) attractorSetDegree(&(loaded->attractors[i].params));
+	memcpy(lib, loaded, sizeof(attractorLibrary));
+	free(loaded);
+	return EXIT_SUCCESS;
+}
+
+
+
+int attractorLibraryReload(attractorLibrary *lib, const char *filename)
+{
+	struct stat st;
+	if(stat(filename, &st)) return 0;
+	if(st.st_mtim.tv_sec == lib->modified.tv_sec && st.st_mtim.tv_nsec == lib->modified.tv_nsec) return 0;
+	if(attractorLibraryLoad(lib, filename)) {
+		// report each broken version once
+		lib->modified = st.st_mtim;
+		return -1;
+	}
+	return 1;
+}
+
+
+
+int attractorCoefficient(const char *name, unsigned int *coordinate, unsigned int *term)
+{
+	float coefficients[NPARAMETERS];
+	const char *error = NULL;
+	if(name[0] != 'd' || name[1] < 'x' || name[1] > 'z' || name[2] != ':') error = "expected dx:, dy: or dz:";
+	else error = parsePolynomial(name+3, coefficients);
+	unsigned int nTerms = 0;
+	for(unsigned int i = 0; error == NULL && i < NPARAMETERS; i++) {
+		if(coefficients[i] == 0.0f) continue;
+		if(coefficients[i] != 1.0f) error = "expected a term without a coefficient";
+		*term = i;
+		nTerms++;
+	}
+	if(error == NULL && nTerms != 1) error = "expected a single term";
+	if(error != NULL) {
+		fprintf(stderr, "Error in coefficient %s: %s\n", name, error);
+		return EXIT_FAILURE;
+	}
+	*coordinate = name[1] - 'x';
+	return EXIT_SUCCESS;
+}
+
+
+
+const attractorDefinition *getAttractor(const attractorLibrary *lib, unsigned int attractor)
+{
+	if(attractor < 1 || attractor > lib->n) {
+		fprintf(stderr, "Error, unrecognised attractor %u, there are %u\n", attractor, lib->n);
+		return NULL;
+	}
+	return &(lib->attractors[attractor-1]);
+}
+
+
+
+static const char *integratorNames[NINTEGRATORS] = {"euler", "rk4", "rk45"};
+
+int getIntegrator(const char *name, unsigned int *integrator)
+{
+	for(unsigned int i = 0; i < NINTEGRATORS; i++) {
+		if(!strcmp(name, integratorNames[i])) {
+			*integrator = i;
+			return EXIT_SUCCESS;
+		}
+	}
+	fprintf(stderr, "Error, unrecognised integrator %s\n", name);
+	return EXIT_FAILURE;
+}
+
+
+
+const char *integratorName(unsigned int integrator)
+{
+	return (integrator < NINTEGRATORS) ? integratorNames[integrator] : "unknown";
+}
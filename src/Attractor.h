@@ -0,0 +1,72 @@
+// Coefficients of the polynomial flows integrated by all backends, up to cubic terms
+
+#ifndef ATTRACTOR_H
+#define ATTRACTOR_H
+
+#include <time.h>
+
+// Terms: 1, x, y, z, xx, xy, xz, yy, yz, zz,
+// then xxx, xxy, xxz, xyy, xyz, xzz, yyy, yyz, yzz, zzz
+#define NPARAMETERS 20
+#define NQUADRATIC 10
+#define MAXDEGREE 3
+
+typedef struct {
+	float X[NPARAMETERS];
+	float Y[NPARAMETERS];
+	float Z[NPARAMETERS];
+	unsigned int degree; // highest with a non-zero coefficient; cubic terms are skipped below 3
+} attractorParameters;
+
+// Set params->degree from the coefficients
+void attractorSetDegree(attractorParameters *params);
+
+// A flow with the view and start-up settings it looks best with
+#define MAXATTRACTORNAME 64
+typedef struct {
+	char name[MAXATTRACTORNAME];
+	attractorParameters params;
+	float stepSize; // recommended, 0: not given
+	float scaleFactor; // positions are divided by this to fit the cube
+	float translation[3];
+	float volSize; // random initial positions in [-volSize,volSize]^3
+} attractorDefinition;
+
+#define MAXATTRACTORS 1024 // also the largest ensemble
+typedef struct {
+	unsigned int n;
+	attractorDefinition attractors[MAXATTRACTORS];
+	struct timespec modified; // of the file loaded, zero for the built-ins
+} attractorLibrary;
+
+// Built-in attractors 1: Lorenz, 2: Roessler, 3: Lu Chen
+void attractorLibraryBuiltin(attractorLibrary *lib);
+
+// Read attractor definitions from a text file, see attractors.conf. lib is only changed on success.
+int attractorLibraryLoad(attractorLibrary *lib, const char *filename);
+
+// Load filename again if it has been modified since lib was read from it. Returns 1 if lib
+// changed, 0 if not and -1 if the new version has errors, in which case lib is kept.
+int attractorLibraryReload(attractorLibrary *lib, const char *filename);
+
+// Coefficient named as in the definitions file, "dy:x*z" for the x*z term of dy or "dz:1" for
+// the constant of dz: coordinate 0 to 2 for dx to dz and the index of the term
+int attractorCoefficient(const char *name, unsigned int *coordinate, unsigned int *term);
+
+// Attractor number (from 1) of the library, NULL with a message if there is none
+const attractorDefinition *getAttractor(const attractorLibrary *lib, unsigned int attractor);
+
+// Integration schemes, implemented by both the shader and the cpu kernels
+#define INTEGRATOR_EULER 0
+#define INTEGRATOR_RK4 1
+#define INTEGRATOR_RK45 2 // Dormand-Prince 5(4), adaptive step size per particle
+#define NINTEGRATORS 3
+
+// RK45 error tolerance, relative to 1+|x| per component
+#define DEFAULTTOLERANCE 1e-5f
+
+// Look up an integrator by name ("euler", "rk4", "rk45"). Returns non-zero if unknown.
+int getIntegrator(const char *name, unsigned int *integrator);
+const char *integratorName(unsigned int integrator);
+
+#endif
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "CpuIntegrator.h"
+#include "GetWallTime.h"
+
+// particles per parallel-for grain, a multiple of CPUPADDING
+#define CPUGRAIN 4096
+
+
+
+// Portable kernels: 128 bit vectors map to SSE2 on x86-64 and NEON on arm64
+namespace generic {
+#define CPU_VECTOR_WIDTH 4
+#include "CpuIntegratorKernels.inc"
+#undef CPU_VECTOR_WIDTH
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86_KERNELS
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to=function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+namespace avx2 {
+#define CPU_VECTOR_WIDTH 8
+#include "CpuIntegratorKernels.inc"
+#undef CPU_VECTOR_WIDTH
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,fma"))), apply_to=function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,fma")
+#endif
+namespace avx512 {
+#define CPU_VECTOR_WIDTH 16
+#include "CpuIntegratorKernels.inc"
+#undef CPU_VECTOR_WIDTH
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+#define NFLOWKERNELS (sizeof(generic::flowKernels)/sizeof(generic::flowKernels[0]))
+static const cpuKernelSet cpuKernelSets[] = {
+#ifdef CPU_X86_KERNELS
+	{"avx512", 16, avx512::flowKernels, NFLOWKERNELS, avx512::packHalfKernel, avx512::randomKernel},
+	{"avx2", 8, avx2::flowKernels, NFLOWKERNELS, avx2::packHalfKernel, avx2::randomKernel},
+#endif
+	{"generic", 4, generic::flowKernels, NFLOWKERNELS, generic::packHalfKernel, generic::randomKernel},
+};
+#define NKERNELSETS (sizeof(cpuKernelSets)/sizeof(cpuKernelSets[0]))
+
+
+
+static int cpuKernelSetSupported(const cpuKernelSet *ks)
+{
+#ifdef CPU_X86_KERNELS
+	__builtin_cpu_init();
+	if(!strcmp(ks->name, "avx512")) return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+	if(!strcmp(ks->name, "avx2")) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+	return !strcmp(ks->name, "generic");
+}
+
+
+
+int cpuIntegratorInit(cpuIntegrator *ci, size_t nParticles, unsigned int nThreads, const char *isa)
+{
+	ci->kernels = NULL;
+	for(size_t i = 0; i < NKERNELSETS; i++) {
+		if(isa != NULL && strcmp(isa, cpuKernelSets[i].name)) continue;
+		if(!cpuKernelSetSupported(&cpuKernelSets[i])) {
+			if(isa != NULL) fprintf(stderr, "Error, instruction set %s not supported by this cpu\n", isa);
+			continue;
+		}
+		ci->kernels = &cpuKernelSets[i];
+		break;
+	}
+	if(ci->kernels == NULL) {
+		fprintf(stderr, "Error, no usable cpu kernels for instruction set %s\n", isa ? isa : "(auto)");
+		return EXIT_FAILURE;
+	}
+
+	ci->x = NULL;
+	ci->y = NULL;
+	ci->z = NULL;
+	ci->h = NULL;
+	ci->nParticles = 0;
+	ci->nAllocated = 0;
+	if(cpuIntegratorResize(ci, nParticles)) return EXIT_FAILURE;
+
+	threadPoolInit(&(ci->pool), nThreads);
+	ci->flow = NULL;
+	ci->nGroups = 0;
+	ci->groups = NULL;
+	ci->groupFlows = NULL;
+	ci->integrationTime = 0.0;
+	ci->particleSteps = 0.0;
+
+	printf("CPU integrator: %s kernels, %u threads\n", ci->kernels->name, ci->pool.nThreads);
+	return EXIT_SUCCESS;
+}
+
+
+
+int cpuIntegratorResize(cpuIntegrator *ci, size_t nParticles)
+{
+	size_t nAllocated = (nParticles + CPUPADDING - 1) / CPUPADDING * CPUPADDING;
+	size_t bytes = nAllocated * sizeof(float);
+	float *x = (float*)aligned_alloc(64, bytes);
+	float *y = (float*)aligned_alloc(64, bytes);
+	float *z = (float*)aligned_alloc(64, bytes);
+	float *h = (float*)aligned_alloc(64, bytes);
+	if(x == NULL || y == NULL || z == NULL || h == NULL) {
+		fprintf(stderr, "Error allocating cpu particle storage for %zu particles\n", nParticles);
+		free(x);
+		free(y);
+		free(z);
+		free(h);
+		return EXIT_FAILURE;
+	}
+	// padding particles are integrated but never read back
+	memset(x, 0, bytes);
+	memset(y, 0, bytes);
+	memset(z, 0, bytes);
+	memset(h, 0, bytes);
+	size_t nKept = (nParticles < ci->nParticles) ? nParticles : ci->nParticles;
+	if(nKept > 0) {
+		memcpy(x, ci->x, nKept * sizeof(float));
+		memcpy(y, ci->y, nKept * sizeof(float));
+		memcpy(z, ci->z, nKept * sizeof(float));
+		memcpy(h, ci->h, nKept * sizeof(float));
+	}
+
+	free(ci->x);
+	free(ci->y);
+	free(ci->z);
+	free(ci->h);
+	ci->x = x;
+	ci->y = y;
+	ci->z = z;
+	ci->h = h;
+	ci->nParticles = nParticles;
+	ci->nAllocated = nAllocated;
+	return EXIT_SUCCESS;
+}
+
+
+
+void cpuIntegratorFree(cpuIntegrator *ci)
+{
+	threadPoolFree(&(ci->pool));
+	free(ci->x);
+	free(ci->y);
+	free(ci->z);
+	free(ci->h);
+	free(ci->groups);
+	free(ci->groupFlows);
+}
+
+
+
+typedef struct {
+	cpuIntegrator *ci;
+	float *pos;
+} layoutArgs;
+
+static void deinterleaveTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	layoutArgs *la = (layoutArgs*)arg;
+	const float *pos = la->pos;
+	for(size_t i = begin; i < end; i++) {
+		la->ci->x[i] = pos[3*i+0];
+		la->ci->y[i] = pos[3*i+1];
+		la->ci->z[i] = pos[3*i+2];
+	}
+}
+
+static void interleaveTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	layoutArgs *la = (layoutArgs*)arg;
+	float *pos = la->pos;
+	for(size_t i = begin; i < end; i++) {
+		pos[3*i+0] = la->ci->x[i];
+		pos[3*i+1] = la->ci->y[i];
+		pos[3*i+2] = la->ci->z[i];
+	}
+}
+
+typedef struct {
+	cpuIntegrator *ci;
+	unsigned short *pos;
+} halfLayoutArgs;
+
+static void interleaveHalfTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	halfLayoutArgs *la = (halfLayoutArgs*)arg;
+	la->ci->kernels->packHalf(la->ci->x, la->ci->y, la->ci->z, la->pos, begin, end);
+}
+
+
+
+void cpuIntegratorSetPositions(cpuIntegrator *ci, const float *pos)
+{
+	layoutArgs la = {ci, (float*)pos};
+	threadPoolParallelFor(&(ci->pool), ci->nParticles, CPUGRAIN, deinterleaveTask, &la);
+}
+
+
+
+void cpuIntegratorGetPositions(cpuIntegrator *ci, float *pos)
+{
+	layoutArgs la = {ci, pos};
+	threadPoolParallelFor(&(ci->pool), ci->nParticles, CPUGRAIN, interleaveTask, &la);
+}
+
+
+
+void cpuIntegratorGetPositionsHalf(cpuIntegrator *ci, unsigned short *pos)
+{
+	halfLayoutArgs la = {ci, pos};
+	threadPoolParallelFor(&(ci->pool), ci->nParticles, CPUGRAIN, interleaveHalfTask, &la);
+}
+
+
+
+typedef struct {
+	cpuIntegrator *ci;
+	size_t first;
+	unsigned int seed;
+	unsigned int stream;
+	float volSize;
+} randomArgs;
+
+static void randomTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	randomArgs *ra = (randomArgs*)arg;
+	ra->ci->kernels->random(ra->ci->x, ra->ci->y, ra->ci->z, ra->first + begin, ra->first + end,
+		ra->seed, ra->stream, ra->volSize);
+}
+
+
+
+void cpuIntegratorRandomPositions(cpuIntegrator *ci, size_t first, float volSize, unsigned int seed, unsigned int stream)
+{
+	if(first >= ci->nParticles) return;
+	randomArgs ra = {ci, first, seed, stream, volSize};
+	threadPoolParallelFor(&(ci->pool), ci->nParticles - first, CPUGRAIN, randomTask, &ra);
+}
+
+
+
+unsigned long long cpuTermMask(const attractorParameters *params)
+{
+	const float *coefficients[3] = {params->X, params->Y, params->Z};
+	unsigned long long mask = 0;
+	for(int c = 0; c < 3; c++) {
+		for(unsigned int i = 1; i < NPARAMETERS; i++) {
+			if(coefficients[c][i] != 0.0f) mask |= CPUTERM(c, i);
+		}
+	}
+	return mask;
+}
+
+
+
+// The first kernels covering every non-zero term of params, the dense cubic ones cover all
+static const cpuFlowKernels *selectFlowKernels(const cpuKernelSet *ks, const attractorParameters *params)
+{
+	unsigned long long mask = cpuTermMask(params);
+	for(unsigned int i = 0; i < ks->nFlows; i++) {
+		if((mask & ~(ks->flows[i].mask)) == 0) return &(ks->flows[i]);
+	}
+	return &(ks->flows[ks->nFlows-1]);
+}
+
+
+
+int cpuIntegratorSetGroups(cpuIntegrator *ci, const attractorParameters *groups, unsigned int nGroups)
+{
+	attractorParameters *copy = NULL;
+	const cpuFlowKernels **flows = NULL;
+	if(nGroups > 0) {
+		copy = (attractorParameters*)malloc(nGroups * sizeof(attractorParameters));
+		flows = (const cpuFlowKernels**)malloc(nGroups * sizeof(const cpuFlowKernels*));
+		if(copy == NULL || flows == NULL) {
+			fprintf(stderr, "Error allocating %u cpu integrator groups\n", nGroups);
+			free(copy);
+			free(flows);
+			return EXIT_FAILURE;
+		}
+		memcpy(copy, groups, nGroups * sizeof(attractorParameters));
+		for(unsigned int g = 0; g < nGroups; g++) flows[g] = selectFlowKernels(ci->kernels, &(groups[g]));
+	}
+	free(ci->groups);
+	free(ci->groupFlows);
+	ci->groups = copy;
+	ci->groupFlows = flows;
+	ci->nGroups = nGroups;
+	return EXIT_SUCCESS;
+}
+
+
+
+size_t cpuIntegratorGroupSize(size_t nParticles, unsigned int nGroups)
+{
+	if(nGroups == 0) nGroups = 1;
+	size_t groupSize = (nParticles + nGroups - 1) / nGroups;
+	return (groupSize + CPUPADDING - 1) / CPUPADDING * CPUPADDING;
+}
+
+
+
+typedef struct {
+	cpuKernelArgs args;
+	cpuKernel kernel;
+	// ensembles: the range of each group goes to the kernel of its flow
+	const cpuIntegrator *ci;
+	unsigned int integrator;
+	size_t groupSize;
+} stepArgs;
+
+static void stepTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	stepArgs *sa = (stepArgs*)arg;
+	if(sa->ci->nGroups == 0) {
+		sa->kernel(&(sa->args), begin, end);
+		return;
+	}
+
+	while(begin < end) {
+		size_t group = begin / sa->groupSize;
+		if(group >= sa->ci->nGroups) group = sa->ci->nGroups - 1;
+		size_t groupEnd = (group == sa->ci->nGroups - 1) ? end : (group + 1) * sa->groupSize;
+		if(groupEnd > end) groupEnd = end;
+
+		cpuKernelArgs args = sa->args;
+		args.params = &(sa->ci->groups[group]);
+		const cpuFlowKernels *flow = sa->ci->groupFlows[group];
+		cpuKernel kernel = (sa->integrator == INTEGRATOR_RK4) ? flow->rk4 : (sa->integrator == INTEGRATOR_RK45) ? flow->rk45 : flow->euler;
+		kernel(&args, begin, groupEnd);
+		begin = groupEnd;
+	}
+}
+
+
+
+void cpuIntegratorStep(cpuIntegrator *ci, const attractorParameters *params, unsigned int integrator,
+	float stepSize, unsigned int nSteps, float tolerance)
+{
+	double startTime = GetWallTime();
+
+	stepArgs sa;
+	sa.args.x = ci->x;
+	sa.args.y = ci->y;
+	sa.args.z = ci->z;
+	sa.args.h = ci->h;
+	sa.args.params = params;
+	sa.args.stepSize = stepSize;
+	sa.args.nSteps = nSteps;
+	sa.args.tolerance = tolerance;
+	sa.ci = ci;
+	sa.integrator = integrator;
+	sa.groupSize = cpuIntegratorGroupSize(ci->nParticles, ci->nGroups);
+
+	if(ci->flow == NULL || memcmp(params, &(ci->flowParams), sizeof(attractorParameters))) {
+		ci->flowParams = *params;
+		ci->flow = selectFlowKernels(ci->kernels, params);
+	}
+	switch(integrator) {
+		case INTEGRATOR_RK4:
+			sa.kernel = ci->flow->rk4;
+			break;
+		case INTEGRATOR_RK45:
+			sa.kernel = ci->flow->rk45;
+			break;
+		default:
+			sa.kernel = ci->flow->euler;
+			break;
+	}
+	// split over the padded size so every range is a whole number of vector blocks
+	threadPoolParallelFor(&(ci->pool), ci->nAllocated, CPUGRAIN, stepTask, &sa);
+
+	ci->integrationTime += GetWallTime() - startTime;
+	ci->particleSteps += (double)ci->nParticles * nSteps;
+}
+
+
+
+typedef struct {
+	cpuIntegrator *ci;
+	const float *m;
+	unsigned int *counts;
+	unsigned int width;
+	unsigned int height;
+} densityArgs;
+
+static void densityTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	densityArgs *da = (densityArgs*)arg;
+	const float *m = da->m;
+	for(size_t i = begin; i < end; i++) {
+		float x = da->ci->x[i];
+		float y = da->ci->y[i];
+		float z = da->ci->z[i];
+		float w = m[3]*x + m[7]*y + m[11]*z + m[15];
+		float cx = m[0]*x + m[4]*y + m[8]*z + m[12];
+		float cy = m[1]*x + m[5]*y + m[9]*z + m[13];
+		if(!(w > 0.0f) || fabsf(cx) > w || fabsf(cy) > w) continue;
+		unsigned int px = (unsigned int)((0.5f*cx/w + 0.5f) * da->width);
+		unsigned int py = (unsigned int)((0.5f*cy/w + 0.5f) * da->height);
+		if(px >= da->width) px = da->width - 1;
+		if(py >= da->height) py = da->height - 1;
+		__atomic_fetch_add(&(da->counts[(size_t)py*da->width + px]), 1, __ATOMIC_RELAXED);
+	}
+}
+
+
+
+void cpuIntegratorDensity(cpuIntegrator *ci, const float *transform, unsigned int *counts,
+	unsigned int width, unsigned int height)
+{
+	densityArgs da = {ci, transform, counts, width, height};
+	threadPoolParallelFor(&(ci->pool), ci->nParticles, CPUGRAIN, densityTask, &da);
+}
+
+
+
+double cpuIntegratorThroughput(cpuIntegrator *ci)
+{
+	double throughput = (ci->integrationTime > 0.0) ? ci->particleSteps / ci->integrationTime : 0.0;
+	ci->integrationTime = 0.0;
+	ci->particleSteps = 0.0;
+	return throughput;
+}
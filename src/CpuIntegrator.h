@@ -0,0 +1,130 @@
+// Multithreaded SIMD CPU integrator of the attractor flow, on SoA particle storage
+
+#ifndef CPUINTEGRATOR_H
+#define CPUINTEGRATOR_H
+
+#include <stddef.h>
+
+#include "Attractor.h"
+#include "ThreadPool.h"
+
+// SoA arrays are padded to a multiple of this many particles (widest vector * unroll)
+#define CPUPADDING 32
+
+// Arguments passed to the kernels for one parallel-for
+typedef struct {
+	float *x;
+	float *y;
+	float *z;
+	float *h; // rk45 per-particle step size, 0: start from stepSize
+	const attractorParameters *params;
+	float stepSize;
+	unsigned int nSteps;
+	float tolerance;
+} cpuKernelArgs;
+
+typedef void (*cpuKernel)(const cpuKernelArgs *args, size_t begin, size_t end);
+
+// Term masks: the bit of coefficient i (1 to NPARAMETERS-1) of coordinate c (0: X, 1: Y, 2: Z).
+// Constant terms are always evaluated.
+#define CPUTERM(c, i) (1ULL << ((NPARAMETERS-1)*(c) + (i)-1))
+#define CPUMASKLORENZ (CPUTERM(0, 1) | CPUTERM(0, 2) | CPUTERM(1, 1) | CPUTERM(1, 2) | CPUTERM(1, 6) | CPUTERM(2, 3) | CPUTERM(2, 5))
+#define CPUMASKROESSLER (CPUTERM(0, 2) | CPUTERM(0, 3) | CPUTERM(1, 1) | CPUTERM(1, 2) | CPUTERM(2, 3) | CPUTERM(2, 6))
+#define CPUMASKARNEODO (CPUTERM(0, 2) | CPUTERM(1, 3) | CPUTERM(2, 1) | CPUTERM(2, 2) | CPUTERM(2, 3) | CPUTERM(2, 10))
+#define CPUMASKQUADRATIC ((CPUTERM(0, NQUADRATIC) - 1) * (1 + CPUTERM(1, 1) + CPUTERM(2, 1)))
+#define CPUMASKCUBIC (CPUTERM(2, NPARAMETERS) - 1)
+
+// Kernels compiled for the flows whose non-zero terms are within mask. The terms outside
+// are left out at compile time, so a sparse flow such as Lorenz (7 of 30 quadratic
+// coefficients) does a fraction of the arithmetic of the dense polynomial.
+typedef struct {
+	unsigned long long mask;
+	const char *name;
+	cpuKernel euler;
+	cpuKernel rk4;
+	cpuKernel rk45;
+} cpuFlowKernels;
+// SoA to interleaved half floats, particles begin to end
+typedef void (*cpuPackKernel)(const float *x, const float *y, const float *z, unsigned short *pos, size_t begin, size_t end);
+// Uniform random positions for particles begin to end, see cpuIntegratorRandomPositions
+typedef void (*cpuRandomKernel)(float *x, float *y, float *z, size_t begin, size_t end,
+	unsigned int seed, unsigned int stream, float volSize);
+
+// One set of kernels per instruction set
+typedef struct {
+	const char *name;
+	unsigned int vectorWidth;
+	const cpuFlowKernels *flows; // from the most specialized to the dense cubic polynomial
+	unsigned int nFlows;
+	cpuPackKernel packHalf;
+	cpuRandomKernel random;
+} cpuKernelSet;
+
+typedef struct {
+	size_t nParticles;
+	size_t nAllocated; // padded
+	float *x;
+	float *y;
+	float *z;
+	float *h;
+	threadPool pool;
+	const cpuKernelSet *kernels;
+	attractorParameters flowParams; // flow the kernels of flow were chosen for
+	const cpuFlowKernels *flow;
+	// ensembles: group g of cpuIntegratorGroupSize particles integrates groups[g], 0: one flow
+	unsigned int nGroups;
+	attractorParameters *groups;
+	const cpuFlowKernels **groupFlows;
+
+	// statistics for particle-steps/second
+	double integrationTime;
+	double particleSteps;
+} cpuIntegrator;
+
+// nThreads = 0 uses all cpus. isa = NULL picks the widest supported instruction set,
+// otherwise one of "generic", "avx2", "avx512".
+int cpuIntegratorInit(cpuIntegrator *ci, size_t nParticles, unsigned int nThreads, const char *isa);
+void cpuIntegratorFree(cpuIntegrator *ci);
+
+// Change the number of particles, keeping the state of those which remain. Added particles
+// are at the origin, call cpuIntegratorRandomPositions. On failure the old storage is kept.
+int cpuIntegratorResize(cpuIntegrator *ci, size_t nParticles);
+
+// Convert from/to the interleaved xyz layout used by the OpenGL buffers
+void cpuIntegratorSetPositions(cpuIntegrator *ci, const float *pos);
+void cpuIntegratorGetPositions(cpuIntegrator *ci, float *pos);
+// As above, converted to IEEE half floats (round to nearest even, tiny values flushed to zero)
+void cpuIntegratorGetPositionsHalf(cpuIntegrator *ci, unsigned short *pos);
+
+// Place particles first to nParticles-1 uniformly in [-volSize,volSize]^3. Particle i gets
+// Philox4x32-10 output for counter (i, stream) under key seed, so the positions do not
+// depend on the thread count or instruction set, and match the gpu initialization shader.
+void cpuIntegratorRandomPositions(cpuIntegrator *ci, size_t first, float volSize, unsigned int seed, unsigned int stream);
+
+// Ensembles: split the particles into nGroups contiguous groups, each integrating its own
+// flow, instead of the params of cpuIntegratorStep. nGroups = 0 goes back to a single flow.
+int cpuIntegratorSetGroups(cpuIntegrator *ci, const attractorParameters *groups, unsigned int nGroups);
+
+// Particles per group, a multiple of CPUPADDING so that groups start on a vector block.
+// The last group may be smaller, or empty.
+size_t cpuIntegratorGroupSize(size_t nParticles, unsigned int nGroups);
+
+// Advance all particles by nSteps steps of size stepSize with one of the INTEGRATOR_ schemes.
+// RK45 instead advances by nSteps*stepSize in time, with adaptive steps to within tolerance.
+// The kernels are those most specialized to the non-zero terms of params, or of each group.
+void cpuIntegratorStep(cpuIntegrator *ci, const attractorParameters *params, unsigned int integrator,
+	float stepSize, unsigned int nSteps, float tolerance);
+
+// Add one to counts[py*width+px] for each particle whose projection falls in the width x height
+// image. transform is a column-major 4x4 matrix from particle to clip coordinates; particles
+// outside the view, as OpenGL would clip point centres, are skipped. Threads add atomically.
+void cpuIntegratorDensity(cpuIntegrator *ci, const float *transform, unsigned int *counts,
+	unsigned int width, unsigned int height);
+
+// Mask of the non-zero terms of params, see CPUTERM
+unsigned long long cpuTermMask(const attractorParameters *params);
+
+// Particle-steps per second since the last call; resets the statistics
+double cpuIntegratorThroughput(cpuIntegrator *ci);
+
+#endif
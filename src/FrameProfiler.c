@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "FrameProfiler.h"
+#include "GetWallTime.h"
+
+
+
+static unsigned int anyGpuPhase(const frameProfiler *p)
+{
+	for(unsigned int i = 0; i < p->nPhases; i++) {
+		if(p->gpu[i]) return 1;
+	}
+	return 0;
+}
+
+
+
+int frameProfilerInit(frameProfiler *p, unsigned int nPhases, const char *const *names, const unsigned int *gpu,
+	const char *logFile)
+{
+	p->nPhases = (nPhases > PROFILERMAXPHASES) ? PROFILERMAXPHASES : nPhases;
+	p->names = names;
+	p->gpu = gpu;
+	p->open = p->nPhases;
+	p->cpuFrames = 0;
+	p->gpuFrames = 0;
+	memset(p->cpu, 0, sizeof(p->cpu));
+	memset(p->cpuWindow, 0, sizeof(p->cpuWindow));
+	memset(p->gpuWindow, 0, sizeof(p->gpuWindow));
+	p->log = NULL;
+	if(logFile != NULL) {
+		p->log = fopen(logFile, "w");
+		if(p->log == NULL) {
+			fprintf(stderr, "Error opening %s\n", logFile);
+			return EXIT_FAILURE;
+		}
+		fprintf(p->log, "frame,frame_cpu_ms");
+		for(unsigned int i = 0; i < p->nPhases; i++) fprintf(p->log, ",%s_cpu_ms", names[i]);
+		for(unsigned int i = 0; i < p->nPhases; i++) {
+			if(gpu[i]) fprintf(p->log, ",%s_gpu_ms", names[i]);
+		}
+		fprintf(p->log, "\n");
+	}
+	gpuTimerInit(&(p->gt), p->nPhases, 0);
+	p->frameStart = GetWallTime();
+	return EXIT_SUCCESS;
+}
+
+
+
+// One line per frame, once both its cpu and gpu times are known. gpu NULL: the gpu times
+// are missing, and left empty.
+static void logFrame(frameProfiler *p, unsigned long long frame, const double *gpu)
+{
+	if(p->log == NULL) return;
+	unsigned int slot = frame % PROFILERWINDOW;
+	fprintf(p->log, "%llu,%.4f", frame, p->cpuWindow[p->nPhases][slot]);
+	for(unsigned int i = 0; i < p->nPhases; i++) fprintf(p->log, ",%.4f", p->cpuWindow[i][slot]);
+	for(unsigned int i = 0; i < p->nPhases; i++) {
+		if(!p->gpu[i]) continue;
+		if(gpu != NULL) fprintf(p->log, ",%.4f", gpu[i]);
+		else fprintf(p->log, ",");
+	}
+	fprintf(p->log, "\n");
+}
+
+
+
+static void storeGpu(frameProfiler *p, unsigned long long frame, const double *results)
+{
+	unsigned int slot = p->gpuFrames++ % PROFILERWINDOW;
+	for(unsigned int i = 0; i < p->nPhases; i++) p->gpuWindow[i][slot] = (float)results[i];
+	logFrame(p, frame, results);
+}
+
+
+
+void frameProfilerFree(frameProfiler *p)
+{
+	// the gpu times of the last frames still pending, oldest first
+	double results[PROFILERMAXPHASES];
+	unsigned long long frame = p->cpuFrames - gpuTimerPending(&(p->gt));
+	while(gpuTimerFlush(&(p->gt), results)) {
+		storeGpu(p, frame++, results);
+	}
+	gpuTimerFree(&(p->gt));
+	if(p->log != NULL) fclose(p->log);
+	p->log = NULL;
+}
+
+
+
+void frameProfilerBegin(frameProfiler *p, unsigned int phase)
+{
+	if(p == NULL) return;
+	p->open = phase;
+	p->openStart = GetWallTime();
+	if(p->gpu[phase]) gpuTimerBegin(&(p->gt), phase);
+}
+
+
+
+void frameProfilerEnd(frameProfiler *p)
+{
+	if(p == NULL || p->open == p->nPhases) return;
+	if(p->gpu[p->open]) gpuTimerEnd(&(p->gt));
+	p->cpu[p->open] += 1e3 * (GetWallTime() - p->openStart);
+	p->open = p->nPhases;
+}
+
+
+
+void frameProfilerEndFrame(frameProfiler *p)
+{
+	if(p == NULL) return;
+	double now = GetWallTime();
+	unsigned long long frame = p->cpuFrames++;
+	unsigned int slot = frame % PROFILERWINDOW;
+	for(unsigned int i = 0; i < p->nPhases; i++) p->cpuWindow[i][slot] = (float)p->cpu[i];
+	p->cpuWindow[p->nPhases][slot] = (float)(1e3 * (now - p->frameStart));
+	memset(p->cpu, 0, sizeof(p->cpu));
+	p->frameStart = now;
+
+	// results come back for the frame GPUTIMERLATENCY-1 before this one, unless the gpu has
+	// not finished it, in which case it is logged without them
+	double results[PROFILERMAXPHASES];
+	if(!anyGpuPhase(p)) {
+		logFrame(p, frame, NULL);
+	}
+	else if(gpuTimerEndFrame(&(p->gt), results) && frame + 1 >= GPUTIMERLATENCY) {
+		storeGpu(p, frame + 1 - GPUTIMERLATENCY, results);
+	}
+	else if(frame + 1 >= GPUTIMERLATENCY) {
+		logFrame(p, frame + 1 - GPUTIMERLATENCY, NULL);
+	}
+}
+
+
+
+static int compareFloats(const void *a, const void *b)
+{
+	float x = *(const float*)a;
+	float y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+
+
+int frameProfilerStats(const frameProfiler *p, unsigned int phase, unsigned int gpu, profilerStats *stats)
+{
+	if(gpu && (phase >= p->nPhases || !p->gpu[phase])) return 0;
+	unsigned long long frames = gpu ? p->gpuFrames : p->cpuFrames;
+	unsigned int n = (frames < PROFILERWINDOW) ? (unsigned int)frames : PROFILERWINDOW;
+	if(n == 0) return 0;
+
+	float sorted[PROFILERWINDOW];
+	memcpy(sorted, gpu ? p->gpuWindow[phase] : p->cpuWindow[phase], n * sizeof(float));
+	qsort(sorted, n, sizeof(float), compareFloats);
+	double sum = 0.0;
+	for(unsigned int i = 0; i < n; i++) sum += sorted[i];
+	stats->min = sorted[0];
+	stats->mean = (float)(sum / n);
+	// the smallest time at least 99% of the frames do not exceed
+	stats->p99 = sorted[(99 * n + 99) / 100 - 1];
+	return 1;
+}
@@ -0,0 +1,58 @@
+// Where the time of a frame goes: the wall time of each phase on the cpu and, for phases which
+// issue gl commands, the GL_TIME_ELAPSED time on the gpu, with the min, mean and 99th percentile
+// over the last PROFILERWINDOW frames. Gpu times arrive GPUTIMERLATENCY-1 frames late, so never
+// stall the pipeline; a frame the gpu has not finished by then gets none. Optionally every frame
+// is logged as a csv line.
+
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <stdio.h>
+
+#include "GpuTimer.h"
+
+#define PROFILERWINDOW 256
+#define PROFILERMAXPHASES GPUTIMERMAXSECTIONS
+
+typedef struct {
+	unsigned int nPhases;
+	const char *const *names;
+	const unsigned int *gpu; // per phase, also timed on the gpu
+	gpuTimer gt;
+	unsigned int open; // phase being timed, nPhases: none
+	double openStart;
+	double frameStart;
+	double cpu[PROFILERMAXPHASES]; // current frame, ms, summed if a phase is timed repeatedly
+	// windows, ms; the last row of cpuWindow is the whole frame. cpuWindow is indexed by
+	// frame, gpuWindow by the gpu samples stored, as frames the gpu had not finished have none.
+	float cpuWindow[PROFILERMAXPHASES+1][PROFILERWINDOW];
+	float gpuWindow[PROFILERMAXPHASES][PROFILERWINDOW];
+	unsigned long long cpuFrames;
+	unsigned long long gpuFrames; // gpu samples stored
+	FILE *log; // NULL: no log
+} frameProfiler;
+
+typedef struct {
+	float min;
+	float mean;
+	float p99;
+} profilerStats;
+
+// names and gpu flags of the nPhases phases, kept by reference. logFile NULL: no log.
+int frameProfilerInit(frameProfiler *p, unsigned int nPhases, const char *const *names, const unsigned int *gpu,
+	const char *logFile);
+void frameProfilerFree(frameProfiler *p);
+
+// Phases may not overlap, and gpu phases may be timed at most once per frame. p NULL: do
+// nothing, so the calls can stay in code shared with unprofiled paths.
+void frameProfilerBegin(frameProfiler *p, unsigned int phase);
+void frameProfilerEnd(frameProfiler *p);
+
+// Close the frame, which started at frameProfilerInit or the previous EndFrame
+void frameProfilerEndFrame(frameProfiler *p);
+
+// Over the frames in the window. phase nPhases on the cpu: the whole frame. Returns 0 if
+// there are no times yet, or the phase is not timed on the gpu.
+int frameProfilerStats(const frameProfiler *p, unsigned int phase, unsigned int gpu, profilerStats *stats);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "FrameWriter.h"
+#include "ImageWriter.h"
+
+#define MAXPATHLENGTH 1024
+
+
+
+static int frameWriterWrite(frameWriter *fw, const unsigned char *rgb, unsigned int number)
+{
+	if(fw->pipe != NULL) {
+		if(writeRawRGB(fw->pipe, rgb, fw->width, fw->height, 1)) {
+			fprintf(stderr, "Error writing frame %u to the encoder\n", number);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	char filename[MAXPATHLENGTH];
+	snprintf(filename, sizeof(filename), "%s/frame_%06u.ppm", fw->outputDir, number);
+	return writePPM(filename, rgb, fw->width, fw->height, 1);
+}
+
+
+
+static void *frameWriterThread(void *arg)
+{
+	frameWriter *fw = (frameWriter*)arg;
+
+	pthread_mutex_lock(&(fw->mutex));
+	while(1) {
+		while(fw->count == 0 && !fw->shutdown) pthread_cond_wait(&(fw->notEmpty), &(fw->mutex));
+		if(fw->count == 0) break;
+		unsigned int slot = fw->head;
+		pthread_mutex_unlock(&(fw->mutex));
+
+		// the submitting thread never touches a queued slot, so no lock is needed here
+		int error = fw->error ? EXIT_FAILURE : frameWriterWrite(fw, fw->frames[slot], fw->numbers[slot]);
+
+		pthread_mutex_lock(&(fw->mutex));
+		if(error) fw->error = 1;
+		else fw->written++;
+		fw->head = (fw->head + 1) % FRAMEWRITERQUEUE;
+		fw->count--;
+		pthread_cond_signal(&(fw->notFull));
+	}
+	pthread_mutex_unlock(&(fw->mutex));
+	return NULL;
+}
+
+
+
+int frameWriterInit(frameWriter *fw, unsigned int width, unsigned int height, const char *outputDir, const char *pipeCommand)
+{
+	memset(fw, 0, sizeof(frameWriter));
+	fw->width = width;
+	fw->height = height;
+	fw->outputDir = outputDir;
+
+	size_t frameBytes = 3 * (size_t)width * height;
+	for(unsigned int i = 0; i < FRAMEWRITERQUEUE; i++) {
+		fw->frames[i] = (unsigned char*)malloc(frameBytes);
+		if(fw->frames[i] == NULL) {
+			fprintf(stderr, "Error allocating %u frame buffers of %zu bytes\n", FRAMEWRITERQUEUE, frameBytes);
+			for(unsigned int j = 0; j < i; j++) free(fw->frames[j]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(pipeCommand != NULL) {
+		// an encoder which exits early should give a write error, not kill the program
+		signal(SIGPIPE, SIG_IGN);
+		fw->pipe = popen(pipeCommand, "w");
+		if(fw->pipe == NULL) {
+			fprintf(stderr, "Error starting encoder: %s\n", pipeCommand);
+			for(unsigned int i = 0; i < FRAMEWRITERQUEUE; i++) free(fw->frames[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	pthread_mutex_init(&(fw->mutex), NULL);
+	pthread_cond_init(&(fw->notEmpty), NULL);
+	pthread_cond_init(&(fw->notFull), NULL);
+	if(pthread_create(&(fw->thread), NULL, frameWriterThread, fw)) {
+		fprintf(stderr, "Error creating frame writer thread\n");
+		if(fw->pipe != NULL) pclose(fw->pipe);
+		for(unsigned int i = 0; i < FRAMEWRITERQUEUE; i++) free(fw->frames[i]);
+		pthread_mutex_destroy(&(fw->mutex));
+		pthread_cond_destroy(&(fw->notEmpty));
+		pthread_cond_destroy(&(fw->notFull));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+int frameWriterSubmit(frameWriter *fw, const unsigned char *rgb, unsigned int number)
+{
+	pthread_mutex_lock(&(fw->mutex));
+	if(fw->count == FRAMEWRITERQUEUE) fw->stalls++;
+	while(fw->count == FRAMEWRITERQUEUE && !fw->error) pthread_cond_wait(&(fw->notFull), &(fw->mutex));
+	int error = fw->error;
+	unsigned int slot = (fw->head + fw->count) % FRAMEWRITERQUEUE;
+	pthread_mutex_unlock(&(fw->mutex));
+	if(error) return EXIT_FAILURE;
+
+	// the writer thread does not touch the slot until count includes it
+	memcpy(fw->frames[slot], rgb, 3 * (size_t)fw->width * fw->height);
+	fw->numbers[slot] = number;
+
+	pthread_mutex_lock(&(fw->mutex));
+	fw->count++;
+	pthread_cond_signal(&(fw->notEmpty));
+	pthread_mutex_unlock(&(fw->mutex));
+	return EXIT_SUCCESS;
+}
+
+
+
+int frameWriterFree(frameWriter *fw)
+{
+	pthread_mutex_lock(&(fw->mutex));
+	fw->shutdown = 1;
+	pthread_cond_signal(&(fw->notEmpty));
+	pthread_mutex_unlock(&(fw->mutex));
+	pthread_join(fw->thread, NULL);
+
+	int error = fw->error;
+	if(fw->pipe != NULL) {
+		int status = pclose(fw->pipe);
+		if(status != 0) {
+			fprintf(stderr, "Encoder exited with status %d\n", status);
+			error = 1;
+		}
+		fw->pipe = NULL;
+	}
+	for(unsigned int i = 0; i < FRAMEWRITERQUEUE; i++) {
+		free(fw->frames[i]);
+		fw->frames[i] = NULL;
+	}
+	pthread_mutex_destroy(&(fw->mutex));
+	pthread_cond_destroy(&(fw->notEmpty));
+	pthread_cond_destroy(&(fw->notFull));
+	return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
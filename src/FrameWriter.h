@@ -0,0 +1,44 @@
+// Writes rendered frames on a separate thread, either as a numbered PPM sequence or as raw
+// rgb24 into the stdin of an encoder command. The queue is bounded: submitting to a full
+// queue waits for the writer, so a slow disk or encoder slows rendering rather than
+// dropping frames or growing memory.
+
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define FRAMEWRITERQUEUE 4
+
+typedef struct {
+	unsigned int width;
+	unsigned int height;
+	const char *outputDir;
+	FILE *pipe; // encoder stdin, NULL for a PPM sequence
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	unsigned char *frames[FRAMEWRITERQUEUE]; // bottom row first, as read from OpenGL
+	unsigned int numbers[FRAMEWRITERQUEUE];
+	unsigned int head;
+	unsigned int count;
+	int shutdown;
+	int error;
+
+	unsigned int written;
+	unsigned int stalls; // submissions which waited for a free slot
+} frameWriter;
+
+// pipeCommand NULL writes <outputDir>/frame_<number>.ppm
+int frameWriterInit(frameWriter *fw, unsigned int width, unsigned int height, const char *outputDir, const char *pipeCommand);
+
+// Copy a width*height RGB frame into the queue. Fails once the writer has hit an error.
+int frameWriterSubmit(frameWriter *fw, const unsigned char *rgb, unsigned int number);
+
+// Write out the queue and stop the thread
+int frameWriterFree(frameWriter *fw);
+
+#endif
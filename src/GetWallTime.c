@@ -3,6 +3,6 @@
 double GetWallTime(void)
 {
 	struct timespec tv;
-	clock_gettime(CLOCK_REALTIME, &tv);
+	clock_gettime(CLOCK_MONOTONIC, &tv);
 	return (double)tv.tv_sec + 1e-9*(double)tv.tv_nsec;
 }
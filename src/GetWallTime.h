@@ -1,4 +1,4 @@
-// Returns ns accurate walltime
+// Returns ns accurate time in seconds from a monotonic clock, for measuring intervals
 
 #include <time.h>
 
@@ -0,0 +1,107 @@
+#include <string.h>
+
+#include "GpuTimer.h"
+
+void gpuTimerInit(gpuTimer *gt, unsigned int nSections, unsigned int wait)
+{
+	gt->wait = wait;
+	gt->nSections = (nSections > GPUTIMERMAXSECTIONS) ? GPUTIMERMAXSECTIONS : nSections;
+	for(unsigned int i = 0; i < GPUTIMERLATENCY; i++) {
+		glGenQueries(gt->nSections, gt->queries[i]);
+	}
+	memset(gt->issued, 0, sizeof(gt->issued));
+	gt->frame = 0;
+}
+
+
+
+void gpuTimerFree(gpuTimer *gt)
+{
+	for(unsigned int i = 0; i < GPUTIMERLATENCY; i++) {
+		glDeleteQueries(gt->nSections, gt->queries[i]);
+	}
+}
+
+
+
+void gpuTimerBegin(gpuTimer *gt, unsigned int section)
+{
+	unsigned int slot = gt->frame % GPUTIMERLATENCY;
+	gt->issued[slot][section] = 1;
+	glBeginQuery(GL_TIME_ELAPSED, gt->queries[slot][section]);
+}
+
+
+
+void gpuTimerEnd(gpuTimer *gt)
+{
+	(void)gt;
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+
+
+static int gpuTimerIssued(const gpuTimer *gt, unsigned int slot)
+{
+	int any = 0;
+	for(unsigned int s = 0; s < gt->nSections; s++) {
+		any |= gt->issued[slot][s];
+	}
+	return any;
+}
+
+
+
+static int gpuTimerCollect(gpuTimer *gt, unsigned int slot, double *results)
+{
+	if(!gpuTimerIssued(gt, slot)) return 0;
+
+	for(unsigned int s = 0; s < gt->nSections; s++) {
+		GLuint64 ns = 0;
+		if(gt->issued[slot][s]) {
+			glGetQueryObjectui64v(gt->queries[slot][s], GL_QUERY_RESULT, &ns);
+		}
+		results[s] = 1e-6 * (double)ns;
+		gt->issued[slot][s] = 0;
+	}
+	return 1;
+}
+
+
+
+int gpuTimerEndFrame(gpuTimer *gt, double *results)
+{
+	gt->frame++;
+	// the slot about to be reused holds the oldest frame: its results are read now if the
+	// gpu has finished every section of it
+	unsigned int slot = gt->frame % GPUTIMERLATENCY;
+	for(unsigned int s = 0; s < gt->nSections; s++) {
+		GLuint available = 1;
+		if(gt->issued[slot][s] && !gt->wait) glGetQueryObjectuiv(gt->queries[slot][s], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available) {
+			memset(gt->issued[slot], 0, sizeof(gt->issued[slot]));
+			return 0;
+		}
+	}
+	return gpuTimerCollect(gt, slot, results);
+}
+
+
+
+unsigned int gpuTimerPending(const gpuTimer *gt)
+{
+	unsigned int pending = 0;
+	for(unsigned int i = 0; i < GPUTIMERLATENCY; i++) pending += gpuTimerIssued(gt, i);
+	return pending;
+}
+
+
+
+int gpuTimerFlush(gpuTimer *gt, double *results)
+{
+	for(unsigned int i = 1; i <= GPUTIMERLATENCY; i++) {
+		unsigned int slot = (gt->frame + i) % GPUTIMERLATENCY;
+		if(gpuTimerCollect(gt, slot, results)) return 1;
+	}
+	return 0;
+}
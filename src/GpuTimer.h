@@ -0,0 +1,42 @@
+// GL_TIME_ELAPSED queries for a fixed set of sections per frame. Results are read
+// GPUTIMERLATENCY-1 frames later, and only once available, so collecting them does not
+// stall the pipeline. A frame whose results are not ready by then is dropped.
+
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <GL/glew.h>
+
+#define GPUTIMERLATENCY 4
+#define GPUTIMERMAXSECTIONS 16
+
+typedef struct {
+	unsigned int nSections;
+	unsigned int queries[GPUTIMERLATENCY][GPUTIMERMAXSECTIONS];
+	unsigned int issued[GPUTIMERLATENCY][GPUTIMERMAXSECTIONS];
+	unsigned int frame; // current ring slot is frame % GPUTIMERLATENCY
+	unsigned int wait; // wait for unfinished frames rather than drop them
+} gpuTimer;
+
+// wait: gpuTimerEndFrame blocks until the old frame is finished instead of dropping it, for
+// measurements where a stall costs nothing but a lost frame would bias the result
+void gpuTimerInit(gpuTimer *gt, unsigned int nSections, unsigned int wait);
+void gpuTimerFree(gpuTimer *gt);
+
+// Sections may not overlap. A section not timed in a frame reports zero.
+void gpuTimerBegin(gpuTimer *gt, unsigned int section);
+void gpuTimerEnd(gpuTimer *gt);
+
+// Finish the current frame. If the frame GPUTIMERLATENCY-1 frames earlier completed,
+// write its section times (ms) to results and return 1. Otherwise return 0 without
+// waiting, unless initialized to wait; that frame's times are dropped, as its queries are
+// about to be reused.
+int gpuTimerEndFrame(gpuTimer *gt, double *results);
+
+// Frames ended whose times have been neither collected nor dropped, the latest ones
+unsigned int gpuTimerPending(const gpuTimer *gt);
+
+// Block until the oldest outstanding frame is available. Call repeatedly until it returns 0.
+int gpuTimerFlush(gpuTimer *gt, double *results);
+
+#endif
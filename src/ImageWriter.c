@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ImageWriter.h"
+
+int writeRawRGB(FILE *fp, const unsigned char *rgb, unsigned int width, unsigned int height, int flipVertical)
+{
+	size_t rowSize = 3 * (size_t)width;
+	for(unsigned int row = 0; row < height; row++) {
+		unsigned int srcRow = flipVertical ? height-1-row : row;
+		if(fwrite(rgb + srcRow*rowSize, 1, rowSize, fp) != rowSize) return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+int writePPM(const char *filename, const unsigned char *rgb, unsigned int width, unsigned int height, int flipVertical)
+{
+	FILE *fp = fopen(filename, "wb");
+	if(fp == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", filename);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(fp, "P6\n%u %u\n255\n", width, height);
+	if(writeRawRGB(fp, rgb, width, height, flipVertical)) {
+		fprintf(stderr, "Error writing %s\n", filename);
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+
+	fclose(fp);
+	return EXIT_SUCCESS;
+}
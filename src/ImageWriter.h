@@ -0,0 +1,14 @@
+// Writes 8 bit RGB images to disk
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <stdio.h>
+
+// Bare rows of pixels, as expected by encoders reading rawvideo rgb24
+int writeRawRGB(FILE *fp, const unsigned char *rgb, unsigned int width, unsigned int height, int flipVertical);
+
+// Binary PPM (P6). flipVertical for OpenGL framebuffers, whose first row is the bottom.
+int writePPM(const char *filename, const unsigned char *rgb, unsigned int width, unsigned int height, int flipVertical);
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Readback.h"
+
+// how long readbackFlush waits per glClientWaitSync call, ns
+#define READBACKWAIT 100000000
+
+
+
+static int readbackAllocate(readbackRing *rr, size_t capacity)
+{
+	const GLbitfield persistentFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	while(glGetError() != GL_NO_ERROR);
+	glGenBuffers(READBACKSLOTS, rr->buffers);
+	for(unsigned int i = 0; i < READBACKSLOTS; i++) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, rr->buffers[i]);
+		if(rr->persistent) {
+			glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, NULL, persistentFlags);
+			rr->mapped[i] = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, persistentFlags);
+		}
+		else {
+			glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STREAM_READ);
+			rr->mapped[i] = NULL;
+		}
+		rr->fences[i] = NULL;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	rr->capacity = capacity;
+	rr->head = 0;
+	rr->pending = 0;
+
+	if(glGetError() != GL_NO_ERROR) {
+		fprintf(stderr, "Error allocating %u readback buffers of %zu bytes\n", READBACKSLOTS, capacity);
+		readbackFree(rr);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+int readbackInit(readbackRing *rr, size_t capacity)
+{
+	rr->persistent = GLEW_ARB_buffer_storage;
+	rr->dropped = 0;
+	return readbackAllocate(rr, (capacity > 0) ? capacity : 1);
+}
+
+
+
+void readbackFree(readbackRing *rr)
+{
+	for(unsigned int i = 0; i < READBACKSLOTS; i++) {
+		if(rr->fences[i] != NULL) glDeleteSync(rr->fences[i]);
+		rr->fences[i] = NULL;
+		if(rr->mapped[i] != NULL) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, rr->buffers[i]);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			rr->mapped[i] = NULL;
+		}
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(READBACKSLOTS, rr->buffers);
+	for(unsigned int i = 0; i < READBACKSLOTS; i++) rr->buffers[i] = 0;
+	rr->capacity = 0;
+	rr->pending = 0;
+}
+
+
+
+// Slot for a request of bytes, or -1 if it has to be dropped
+static int readbackReserve(readbackRing *rr, size_t bytes)
+{
+	// storage from glBufferStorage is immutable, so growing means new buffers
+	if(bytes > rr->capacity) {
+		rr->dropped += rr->pending;
+		readbackFree(rr);
+		if(readbackAllocate(rr, bytes)) return -1;
+	}
+	if(rr->pending == READBACKSLOTS) {
+		rr->dropped++;
+		return -1;
+	}
+	return (rr->head + rr->pending) % READBACKSLOTS;
+}
+
+
+
+static void readbackQueue(readbackRing *rr, unsigned int slot, size_t bytes, unsigned long long tag)
+{
+	rr->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	rr->bytes[slot] = bytes;
+	rr->tags[slot] = tag;
+	rr->pending++;
+}
+
+
+
+int readbackRequest(readbackRing *rr, unsigned int buffer, size_t bytes, unsigned long long tag)
+{
+	int slot = readbackReserve(rr, bytes);
+	if(slot < 0) return 0;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, rr->buffers[slot]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, bytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	readbackQueue(rr, slot, bytes, tag);
+	return 1;
+}
+
+
+
+int readbackRequestPixels(readbackRing *rr, unsigned int width, unsigned int height, unsigned long long tag)
+{
+	size_t bytes = 3 * (size_t)width * height;
+	int slot = readbackReserve(rr, bytes);
+	if(slot < 0) return 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rr->buffers[slot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, (void*)0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readbackQueue(rr, slot, bytes, tag);
+	return 1;
+}
+
+
+
+// Deliver completed copies in order, blocking on at most the first nWait
+static unsigned int readbackDeliver(readbackRing *rr, readbackCallback callback, void *arg, unsigned int nWait)
+{
+	unsigned int delivered = 0;
+	while(rr->pending > 0) {
+		unsigned int slot = rr->head;
+		int wait = (delivered < nWait);
+		GLenum status = glClientWaitSync(rr->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, wait ? READBACKWAIT : 0);
+		while(wait && status == GL_TIMEOUT_EXPIRED) {
+			status = glClientWaitSync(rr->fences[slot], 0, READBACKWAIT);
+		}
+		if(status == GL_TIMEOUT_EXPIRED) break;
+
+		if(status == GL_WAIT_FAILED) {
+			fprintf(stderr, "Error waiting for readback fence\n");
+			rr->dropped++;
+		}
+		else if(rr->persistent) {
+			callback(arg, rr->mapped[slot], rr->bytes[slot], rr->tags[slot]);
+			delivered++;
+		}
+		else {
+			// the copy has completed, so mapping does not stall
+			glBindBuffer(GL_COPY_WRITE_BUFFER, rr->buffers[slot]);
+			const void *data = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, rr->bytes[slot], GL_MAP_READ_BIT);
+			if(data != NULL) {
+				callback(arg, data, rr->bytes[slot], rr->tags[slot]);
+				glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+				delivered++;
+			}
+			else {
+				fprintf(stderr, "Error mapping readback buffer\n");
+				rr->dropped++;
+			}
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteSync(rr->fences[slot]);
+		rr->fences[slot] = NULL;
+		rr->head = (rr->head + 1) % READBACKSLOTS;
+		rr->pending--;
+	}
+	return delivered;
+}
+
+
+
+unsigned int readbackPoll(readbackRing *rr, readbackCallback callback, void *arg)
+{
+	return readbackDeliver(rr, callback, arg, 0);
+}
+
+
+
+unsigned int readbackWait(readbackRing *rr, readbackCallback callback, void *arg)
+{
+	return readbackDeliver(rr, callback, arg, 1);
+}
+
+
+
+unsigned int readbackFlush(readbackRing *rr, readbackCallback callback, void *arg)
+{
+	return readbackDeliver(rr, callback, arg, READBACKSLOTS);
+}
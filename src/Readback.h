@@ -0,0 +1,52 @@
+// Asynchronous readback of buffer or framebuffer contents through a ring of staging buffers.
+// A request copies on the gpu and sets a fence; completed copies are handed over on a later frame,
+// so the render loop never waits for the gpu. Staging buffers are persistently mapped
+// when ARB_buffer_storage is available, otherwise mapped once their fence has signalled.
+
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+#define READBACKSLOTS 3
+
+// data is valid only during the call
+typedef void (*readbackCallback)(void *arg, const void *data, size_t bytes, unsigned long long tag);
+
+typedef struct {
+	unsigned int buffers[READBACKSLOTS];
+	void *mapped[READBACKSLOTS]; // persistent mappings, NULL otherwise
+	GLsync fences[READBACKSLOTS];
+	size_t bytes[READBACKSLOTS];
+	unsigned long long tags[READBACKSLOTS];
+	size_t capacity; // bytes per staging buffer
+	unsigned int persistent;
+	unsigned int head; // oldest pending slot
+	unsigned int pending;
+	unsigned int dropped; // requests lost to a full ring or a reallocation
+} readbackRing;
+
+int readbackInit(readbackRing *rr, size_t capacity);
+void readbackFree(readbackRing *rr);
+
+// Queue a copy of the first bytes of buffer, labelled with tag. Never waits: returns 0 and
+// counts a drop if every slot is still in flight. A request larger than the capacity
+// reallocates the ring, dropping the copies in flight.
+int readbackRequest(readbackRing *rr, unsigned int buffer, size_t bytes, unsigned long long tag);
+
+// As above for the pixels of the current read framebuffer, tightly packed 8 bit RGB rows
+// from the bottom up
+int readbackRequestPixels(readbackRing *rr, unsigned int width, unsigned int height, unsigned long long tag);
+
+// Pass each completed copy, oldest first, to callback. Returns the number delivered.
+unsigned int readbackPoll(readbackRing *rr, readbackCallback callback, void *arg);
+
+// As above, first waiting for the oldest copy in flight. Lets a caller which must not drop
+// requests make room in a full ring.
+unsigned int readbackWait(readbackRing *rr, readbackCallback callback, void *arg);
+
+// As above, waiting for every copy in flight
+unsigned int readbackFlush(readbackRing *rr, readbackCallback callback, void *arg);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Reference.h"
+
+
+
+static const char *precisionNames[NREFERENCEPRECISIONS] = {"double", "long"};
+
+int getReferencePrecision(const char *name, unsigned int *precision)
+{
+	for(unsigned int i = 0; i < NREFERENCEPRECISIONS; i++) {
+		if(!strcmp(name, precisionNames[i])) {
+			*precision = i;
+			return EXIT_SUCCESS;
+		}
+	}
+	fprintf(stderr, "Error, unrecognised reference precision %s\n", name);
+	return EXIT_FAILURE;
+}
+
+
+
+const char *referencePrecisionName(unsigned int precision)
+{
+	return (precision == REFERENCE_LONGDOUBLE) ? "long double" : "double";
+}
+
+
+
+// Terms in the order of Attractor.h, quadratic and cubic sums kept apart as in the kernels
+template<typename real>
+static void velocity(const real c[3][NPARAMETERS], unsigned int degree, const real x[3], real v[3])
+{
+	const real xx = x[0]*x[0];
+	const real xy = x[0]*x[1];
+	const real xz = x[0]*x[2];
+	const real yy = x[1]*x[1];
+	const real yz = x[1]*x[2];
+	const real zz = x[2]*x[2];
+	const real m[NPARAMETERS] = {1, x[0], x[1], x[2], xx, xy, xz, yy, yz, zz,
+		xx*x[0], xx*x[1], xx*x[2], xy*x[1], xy*x[2], xz*x[2], yy*x[1], yy*x[2], yz*x[2], zz*x[2]};
+	for(int k = 0; k < 3; k++) {
+		real sum = c[k][0];
+		for(int i = 1; i < NQUADRATIC; i++) sum += c[k][i]*m[i];
+		if(degree >= 3) {
+			real cubic = 0;
+			for(int i = NQUADRATIC; i < NPARAMETERS; i++) cubic += c[k][i]*m[i];
+			sum += cubic;
+		}
+		v[k] = sum;
+	}
+}
+
+
+
+template<typename real>
+static void integrate(const attractorParameters *params, unsigned int integrator, double stepSize,
+	unsigned long long nSteps, double *pos, size_t n)
+{
+	real c[3][NPARAMETERS];
+	for(int i = 0; i < NPARAMETERS; i++) {
+		c[0][i] = params->X[i];
+		c[1][i] = params->Y[i];
+		c[2][i] = params->Z[i];
+	}
+	const real h = stepSize;
+
+	for(size_t p = 0; p < n; p++) {
+		real x[3] = {pos[3*p], pos[3*p+1], pos[3*p+2]};
+		for(unsigned long long s = 0; s < nSteps; s++) {
+			real k1[3];
+			velocity<real>(c, params->degree, x, k1);
+			if(integrator == INTEGRATOR_EULER) {
+				for(int k = 0; k < 3; k++) x[k] += h*k1[k];
+				continue;
+			}
+			real k2[3], k3[3], k4[3], t[3];
+			for(int k = 0; k < 3; k++) t[k] = x[k] + h/2*k1[k];
+			velocity<real>(c, params->degree, t, k2);
+			for(int k = 0; k < 3; k++) t[k] = x[k] + h/2*k2[k];
+			velocity<real>(c, params->degree, t, k3);
+			for(int k = 0; k < 3; k++) t[k] = x[k] + h*k3[k];
+			velocity<real>(c, params->degree, t, k4);
+			for(int k = 0; k < 3; k++) x[k] += h/6*(k1[k] + 2*k2[k] + 2*k3[k] + k4[k]);
+		}
+		for(int k = 0; k < 3; k++) pos[3*p+k] = (double)x[k];
+	}
+}
+
+
+
+int referenceIntegrate(const attractorParameters *params, unsigned int precision, unsigned int integrator,
+	double stepSize, unsigned long long nSteps, double *pos, size_t n)
+{
+	if(integrator != INTEGRATOR_EULER && integrator != INTEGRATOR_RK4) {
+		fprintf(stderr, "Error, the reference integrates with euler or rk4, not %s\n", integratorName(integrator));
+		return EXIT_FAILURE;
+	}
+	if(precision == REFERENCE_LONGDOUBLE) {
+		integrate<long double>(params, integrator, stepSize, nSteps, pos, n);
+	}
+	else {
+		integrate<double>(params, integrator, stepSize, nSteps, pos, n);
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+static int compareDoubles(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+
+
+int referenceCompare(const double *pos, const double *ref, size_t n, double threshold, referenceErrors *e)
+{
+	double *distance = (double*)malloc(n * sizeof(double));
+	if(distance == NULL || n == 0) {
+		fprintf(stderr, "Error allocating distances of %zu particles\n", n);
+		free(distance);
+		return EXIT_FAILURE;
+	}
+	double sumSquares = 0.0;
+	size_t finite = 0, diverged = 0;
+	for(size_t p = 0; p < n; p++) {
+		double dx = pos[3*p] - ref[3*p];
+		double dy = pos[3*p+1] - ref[3*p+1];
+		double dz = pos[3*p+2] - ref[3*p+2];
+		double d = sqrt(dx*dx + dy*dy + dz*dz);
+		// an escaped particle is infinitely far, whatever its coordinates
+		if(!isfinite(d)) d = INFINITY;
+		distance[p] = d;
+		if(isfinite(d)) {
+			sumSquares += d*d;
+			finite++;
+		}
+		if(!(d <= threshold)) diverged++;
+	}
+	qsort(distance, n, sizeof(double), compareDoubles);
+	e->rms = (finite > 0) ? sqrt(sumSquares / finite) : INFINITY;
+	e->median = distance[(n - 1) / 2];
+	// the smallest distance at least 99% of the particles do not exceed
+	e->p99 = distance[(99 * n + 99) / 100 - 1];
+	e->max = distance[n - 1];
+	e->diverged = (double)diverged / n;
+	free(distance);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+// Reference integration of the attractor flows in double or long double precision, one
+// particle at a time on one thread, and the error of positions against it. The float
+// backends are measured against this by --validate.
+
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include <stddef.h>
+
+#include "Attractor.h"
+
+// Precision of the arithmetic. Positions are passed in and out as double either way.
+#define REFERENCE_DOUBLE 0
+#define REFERENCE_LONGDOUBLE 1
+#define NREFERENCEPRECISIONS 2
+
+// Look up a precision by name ("double", "long"). Returns non-zero if unknown.
+int getReferencePrecision(const char *name, unsigned int *precision);
+const char *referencePrecisionName(unsigned int precision);
+
+// Advance the n interleaved xyz positions by nSteps steps of stepSize, with INTEGRATOR_EULER
+// or INTEGRATOR_RK4. The same polynomial as the shader and the cpu kernels, with every term
+// up to params->degree evaluated whatever the coefficients. Returns non-zero for other
+// integrators.
+int referenceIntegrate(const attractorParameters *params, unsigned int precision, unsigned int integrator,
+	double stepSize, unsigned long long nSteps, double *pos, size_t n);
+
+typedef struct {
+	double rms; // over the particles which did not escape
+	double median;
+	double p99;
+	double max; // infinite if any particle escaped
+	double diverged; // fraction further than the threshold from the reference, or escaped
+} referenceErrors;
+
+// Distances between the n xyz positions pos and ref
+int referenceCompare(const double *pos, const double *ref, size_t n, double threshold, referenceErrors *e);
+
+#endif
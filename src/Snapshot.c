@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Snapshot.h"
+
+void snapshotInitHeader(snapshotHeader *header)
+{
+	memset(header, 0, sizeof(snapshotHeader));
+	memcpy(header->magic, SNAPSHOTMAGIC, sizeof(header->magic));
+	header->version = SNAPSHOTVERSION;
+	header->headerBytes = sizeof(snapshotHeader);
+	header->nParameters = NPARAMETERS;
+}
+
+
+
+int snapshotWriteHeader(FILE *fp, const snapshotHeader *header)
+{
+	if(fwrite(header, sizeof(snapshotHeader), 1, fp) != 1) {
+		fprintf(stderr, "Error writing snapshot header\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+int snapshotMap(snapshotMapping *sm, const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Error opening snapshot %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	struct stat st;
+	if(fstat(fd, &st) || (size_t)st.st_size < offsetof(snapshotHeader, X)) {
+		fprintf(stderr, "Error, %s is too short for a snapshot\n", filename);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	sm->mapBytes = st.st_size;
+	sm->map = mmap(NULL, sm->mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(sm->map == MAP_FAILED) {
+		fprintf(stderr, "Error mapping snapshot %s\n", filename);
+		return EXIT_FAILURE;
+	}
+
+	// the coefficient arrays are nParameters long in the file
+	const size_t fixedBytes = offsetof(snapshotHeader, X);
+	memset(&(sm->header), 0, sizeof(snapshotHeader));
+	memcpy(&(sm->header), sm->map, fixedBytes);
+	snapshotHeader *h = &(sm->header);
+	const char *error = NULL;
+	if(memcmp(h->magic, SNAPSHOTMAGIC, sizeof(h->magic))) error = "not a snapshot";
+	else if(h->version > SNAPSHOTVERSION) error = "written by a newer version";
+	else if(h->nParameters > NPARAMETERS) error = "more attractor parameters than supported";
+	else if(h->integrator >= NINTEGRATORS) error = "unknown integrator";
+	else if(h->headerBytes < fixedBytes + 3*h->nParameters*sizeof(float) || h->headerBytes % sizeof(float)) error = "bad header size";
+	else if(h->headerBytes > sm->mapBytes) error = "truncated header";
+	else {
+		const float *coefficients = (const float*)((const char*)sm->map + fixedBytes);
+		memcpy(h->X, coefficients, h->nParameters*sizeof(float));
+		memcpy(h->Y, coefficients + h->nParameters, h->nParameters*sizeof(float));
+		memcpy(h->Z, coefficients + 2*h->nParameters, h->nParameters*sizeof(float));
+		// each array is checked against the remaining bytes, so nothing here can overflow
+		size_t remaining = sm->mapBytes - h->headerBytes;
+		if(h->nParticles > remaining / (3*sizeof(float))) error = "truncated positions";
+		else if((h->flags & SNAPSHOTSTEPSIZES) && h->nParticles > (remaining - h->nParticles*3*sizeof(float)) / sizeof(float)) {
+			error = "truncated step sizes";
+		}
+	}
+	if(error != NULL) {
+		fprintf(stderr, "Error reading snapshot %s: %s\n", filename, error);
+		snapshotUnmap(sm);
+		return EXIT_FAILURE;
+	}
+
+	const char *data = (const char*)sm->map + h->headerBytes;
+	sm->positions = (const float*)data;
+	sm->stepSizes = (h->flags & SNAPSHOTSTEPSIZES) ? (const float*)(data + h->nParticles*3*sizeof(float)) : NULL;
+	madvise(sm->map, sm->mapBytes, MADV_SEQUENTIAL);
+	return EXIT_SUCCESS;
+}
+
+
+
+void snapshotUnmap(snapshotMapping *sm)
+{
+	munmap(sm->map, sm->mapBytes);
+	sm->map = NULL;
+	sm->positions = NULL;
+	sm->stepSizes = NULL;
+}
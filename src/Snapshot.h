@@ -0,0 +1,56 @@
+// Versioned binary snapshots of the simulation state, for checkpoint and restart.
+// Layout, little-endian: snapshotHeader, then headerBytes from the start the interleaved
+// xyz float32 positions, then with SNAPSHOTSTEPSIZES one float32 rk45 step size per particle.
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Attractor.h"
+
+#define SNAPSHOTMAGIC "ATTRSNAP"
+#define SNAPSHOTVERSION 1
+
+// flags
+#define SNAPSHOTSTEPSIZES 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes; // offset of the positions, later versions may append fields
+	uint32_t flags;
+	uint32_t integrator;
+	uint32_t nParameters; // per coordinate, older files with fewer terms are read zero-filled
+	float stepSize;
+	float tolerance;
+	uint32_t reserved;
+	uint64_t steps; // integration steps since the initial positions
+	uint64_t nParticles;
+	float X[NPARAMETERS];
+	float Y[NPARAMETERS];
+	float Z[NPARAMETERS];
+} snapshotHeader;
+
+// A snapshot file mapped read-only into memory
+typedef struct {
+	snapshotHeader header;
+	const float *positions;
+	const float *stepSizes; // NULL without SNAPSHOTSTEPSIZES
+	void *map;
+	size_t mapBytes;
+} snapshotMapping;
+
+// Fill in magic, version and size; the caller sets the rest
+void snapshotInitHeader(snapshotHeader *header);
+
+// Streaming writes: the header first, then the caller appends the data with fwrite
+int snapshotWriteHeader(FILE *fp, const snapshotHeader *header);
+
+// Map and validate a snapshot. The data is paged in as it is read.
+int snapshotMap(snapshotMapping *sm, const char *filename);
+void snapshotUnmap(snapshotMapping *sm);
+
+#endif
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "Sweep.h"
+#include "ImageWriter.h"
+#include "GetWallTime.h"
+
+#define MAXPATHLENGTH 1024
+#define SWEEPBATCHPARTICLES (1 << 19) // integrated at once, the points of a batch share a parallel-for
+#define SWEEPRENORMTIME 0.1f // simulated time between renormalizations of the pairs
+#define SWEEPSEPARATION 1e-4f // of the pairs, relative to the initial volume
+#define SWEEPBOUND 100.0f // pairs further than this times the initial volume have diverged
+
+
+
+void sweepDefaults(sweepSettings *s)
+{
+	s->nAxes = 0;
+	s->cloudSize = CPUPADDING;
+	s->transient = 10.0f;
+	s->time = 50.0f;
+}
+
+
+
+int sweepParseAxis(const char *spec, sweepAxis *axis)
+{
+	const char *equals = strchr(spec, '=');
+	size_t nameLength = (equals != NULL) ? (size_t)(equals - spec) : 0;
+	char end;
+	if(nameLength == 0 || nameLength >= MAXSWEEPNAME
+		|| sscanf(equals+1, "%f:%f:%u%c", &(axis->min), &(axis->max), &(axis->n), &end) != 3 || axis->n == 0) {
+		fprintf(stderr, "Error, sweep should be COEFFICIENT=MIN:MAX:N, got %s\n", spec);
+		return EXIT_FAILURE;
+	}
+	memcpy(axis->name, spec, nameLength);
+	axis->name[nameLength] = '\0';
+	return attractorCoefficient(axis->name, &(axis->coordinate), &(axis->term));
+}
+
+
+
+size_t sweepPoints(const sweepSettings *s)
+{
+	size_t n = (s->nAxes > 0) ? 1 : 0;
+	for(unsigned int a = 0; a < s->nAxes; a++) n *= s->axes[a].n;
+	return n;
+}
+
+
+
+static float axisValue(const sweepAxis *axis, size_t i)
+{
+	return (axis->n > 1) ? axis->min + (axis->max - axis->min) * (float)i / (float)(axis->n - 1) : axis->min;
+}
+
+
+
+// Flow of point p of the grid
+static void sweepFlow(const sweepSettings *s, const attractorParameters *base, size_t p, attractorParameters *params)
+{
+	*params = *base;
+	float *coefficients[3] = {params->X, params->Y, params->Z};
+	for(unsigned int a = 0; a < s->nAxes; a++) {
+		const sweepAxis *axis = &(s->axes[a]);
+		coefficients[axis->coordinate][axis->term] = axisValue(axis, p % axis->n);
+		p /= axis->n;
+	}
+	attractorSetDegree(params);
+}
+
+
+
+typedef struct {
+	cpuIntegrator *ci;
+	size_t cloudSize;
+	float separation;
+	float bound;
+	unsigned int measure; // accumulate the stretching, otherwise only renormalize
+	// per pair: the stretching is multiplied up, and moved into the log only when the product
+	// nears the limits of a double, which saves a log per pair and interval
+	double *stretch;
+	double *logStretch;
+	unsigned char *diverged;
+} renormalizeArgs;
+
+// Benettin's method: measure how far each perturbed particle has moved from its reference,
+// then put it back at the initial separation along the same direction
+static void renormalizeTask(void *arg, size_t begin, size_t end, unsigned int threadIndex)
+{
+	(void)threadIndex;
+	renormalizeArgs *ra = (renormalizeArgs*)arg;
+	float *x = ra->ci->x;
+	float *y = ra->ci->y;
+	float *z = ra->ci->z;
+	const size_t half = ra->cloudSize / 2;
+	const float d0 = ra->separation;
+
+	for(size_t point = begin; point < end; point++) {
+		for(size_t i = 0; i < half; i++) {
+			size_t pair = point*half + i;
+			size_t r = point*ra->cloudSize + i;
+			size_t q = r + half;
+			if(ra->diverged[pair]) continue;
+			// written to be false for NaN
+			if(!(fabsf(x[r]) < ra->bound && fabsf(y[r]) < ra->bound && fabsf(z[r]) < ra->bound
+				&& fabsf(x[q]) < ra->bound && fabsf(y[q]) < ra->bound && fabsf(z[q]) < ra->bound)) {
+				ra->diverged[pair] = 1;
+				continue;
+			}
+
+			float dx = x[q] - x[r];
+			float dy = y[q] - y[r];
+			float dz = z[q] - z[r];
+			float d = sqrtf(dx*dx + dy*dy + dz*dz);
+			if(ra->measure) {
+				double stretch = ra->stretch[pair] * (fmaxf(d, FLT_MIN) / d0);
+				if(stretch > 1e250 || stretch < 1e-250) {
+					ra->logStretch[pair] += log(stretch);
+					stretch = 1.0;
+				}
+				ra->stretch[pair] = stretch;
+			}
+			if(d > 0.0f) {
+				dx *= d0/d;
+				dy *= d0/d;
+				dz *= d0/d;
+			}
+			else {
+				// collapsed onto the reference, start again along the diagonal
+				dx = dy = dz = d0/sqrtf(3.0f);
+			}
+			x[q] = x[r] + dx;
+			y[q] = y[r] + dy;
+			z[q] = z[r] + dz;
+		}
+	}
+}
+
+
+
+int sweepRun(const sweepSettings *s, cpuIntegrator *ci, const attractorParameters *base, unsigned int integrator,
+	float stepSize, float tolerance, float volSize, unsigned int seed, sweepPoint *points)
+{
+	const size_t nPoints = sweepPoints(s);
+	const size_t cloudSize = s->cloudSize;
+	const size_t half = cloudSize / 2;
+	const size_t batchPoints = (SWEEPBATCHPARTICLES / cloudSize > 0) ? SWEEPBATCHPARTICLES / cloudSize : 1;
+	const size_t maxPoints = (nPoints < batchPoints) ? nPoints : batchPoints;
+	// whole intervals between renormalizations; rk45 covers nSteps*stepSize in time as well
+	const unsigned int intervalSteps = (SWEEPRENORMTIME > stepSize) ? (unsigned int)lroundf(SWEEPRENORMTIME / stepSize) : 1;
+	const float intervalTime = intervalSteps * stepSize;
+	const unsigned int transientIntervals = (unsigned int)ceilf(s->transient / intervalTime);
+	unsigned int measureIntervals = (unsigned int)ceilf(s->time / intervalTime);
+	if(measureIntervals == 0) measureIntervals = 1;
+
+	attractorParameters *groups = (attractorParameters*)malloc(maxPoints * sizeof(attractorParameters));
+	double *stretch = (double*)malloc(maxPoints * half * sizeof(double));
+	double *logStretch = (double*)malloc(maxPoints * half * sizeof(double));
+	unsigned char *diverged = (unsigned char*)malloc(maxPoints * half);
+	if(groups == NULL || stretch == NULL || logStretch == NULL || diverged == NULL) {
+		fprintf(stderr, "Error allocating a sweep batch of %zu points\n", maxPoints);
+		free(groups);
+		free(stretch);
+		free(logStretch);
+		free(diverged);
+		return EXIT_FAILURE;
+	}
+
+	printf("Sweep: %zu points of %zu particles, %u + %u intervals of %u steps, %s integrator\n",
+		nPoints, cloudSize, transientIntervals, measureIntervals, intervalSteps, integratorName(integrator));
+	double startTime = GetWallTime();
+	double particleSteps = 0.0;
+	unsigned int batch = 0;
+	int status = EXIT_SUCCESS;
+	for(size_t first = 0; first < nPoints; first += maxPoints, batch++) {
+		size_t n = (nPoints - first < maxPoints) ? nPoints - first : maxPoints;
+		for(size_t p = 0; p < n; p++) sweepFlow(s, base, first + p, &(groups[p]));
+		if((n * cloudSize != ci->nParticles && cpuIntegratorResize(ci, n * cloudSize)) || cpuIntegratorSetGroups(ci, groups, n)) {
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		// a fresh cloud per batch; rk45 starts again from stepSize
+		const float d0 = SWEEPSEPARATION * volSize;
+		cpuIntegratorRandomPositions(ci, 0, volSize, seed, batch);
+		memset(ci->h, 0, ci->nAllocated * sizeof(float));
+		for(size_t p = 0; p < n; p++) {
+			for(size_t i = 0; i < half; i++) {
+				size_t r = p*cloudSize + i;
+				ci->x[r + half] = ci->x[r] + d0/sqrtf(3.0f);
+				ci->y[r + half] = ci->y[r] + d0/sqrtf(3.0f);
+				ci->z[r + half] = ci->z[r] + d0/sqrtf(3.0f);
+			}
+		}
+		for(size_t i = 0; i < n * half; i++) stretch[i] = 1.0;
+		memset(logStretch, 0, n * half * sizeof(double));
+		memset(diverged, 0, n * half);
+
+		renormalizeArgs ra = {ci, cloudSize, d0, SWEEPBOUND * volSize, 0, stretch, logStretch, diverged};
+		for(unsigned int interval = 0; interval < transientIntervals + measureIntervals; interval++) {
+			cpuIntegratorStep(ci, base, integrator, stepSize, intervalSteps, tolerance);
+			ra.measure = (interval >= transientIntervals);
+			threadPoolParallelFor(&(ci->pool), n, 1, renormalizeTask, &ra);
+		}
+		particleSteps += (double)n * cloudSize * intervalSteps * (transientIntervals + measureIntervals);
+
+		for(size_t p = 0; p < n; p++) {
+			double sum = 0.0;
+			unsigned int nBounded = 0;
+			for(size_t i = p*half; i < (p+1)*half; i++) {
+				if(diverged[i]) continue;
+				sum += logStretch[i] + log(stretch[i]);
+				nBounded++;
+			}
+			points[first + p].lyapunov = (nBounded > 0) ? sum / (nBounded * (double)measureIntervals * intervalTime) : NAN;
+			points[first + p].bounded = (float)nBounded / half;
+		}
+		printf("Sweep: %zu of %zu points\n", first + n, nPoints);
+	}
+	cpuIntegratorSetGroups(ci, NULL, 0);
+	free(groups);
+	free(stretch);
+	free(logStretch);
+	free(diverged);
+
+	double elapsed = GetWallTime() - startTime;
+	printf("Sweep: %.3lf s, %.4g points/s, %.4g particle-steps/s\n", elapsed, nPoints / elapsed, particleSteps / elapsed);
+	return status;
+}
+
+
+
+// Divergent points black, chaotic ones from dark red to yellow and the others from dark
+// to bright blue, each scaled by the largest exponent of its sign
+static void sweepColour(const sweepPoint *p, float maxPositive, float maxNegative, unsigned char *rgb)
+{
+	rgb[0] = rgb[1] = rgb[2] = 0;
+	if(!(p->bounded > 0.0f)) return;
+	if(p->lyapunov > 0.0f) {
+		float t = (maxPositive > 0.0f) ? p->lyapunov / maxPositive : 1.0f;
+		rgb[0] = (unsigned char)(128.0f + 127.0f*t);
+		rgb[1] = (unsigned char)(255.0f*t);
+	}
+	else {
+		float t = (maxNegative > 0.0f) ? -p->lyapunov / maxNegative : 1.0f;
+		rgb[2] = (unsigned char)(128.0f + 127.0f*t);
+	}
+}
+
+
+
+int sweepWrite(const sweepSettings *s, const sweepPoint *points, const char *outputDir)
+{
+	const size_t nPoints = sweepPoints(s);
+	char filename[MAXPATHLENGTH];
+	snprintf(filename, MAXPATHLENGTH, "%s/sweep.csv", outputDir);
+	FILE *fp = fopen(filename, "w");
+	if(fp == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", filename);
+		return EXIT_FAILURE;
+	}
+	for(unsigned int a = 0; a < s->nAxes; a++) fprintf(fp, "%s,", s->axes[a].name);
+	fprintf(fp, "lyapunov,bounded\n");
+	float maxPositive = 0.0f, maxNegative = 0.0f;
+	for(size_t p = 0; p < nPoints; p++) {
+		size_t i = p;
+		for(unsigned int a = 0; a < s->nAxes; a++) {
+			fprintf(fp, "%.9g,", axisValue(&(s->axes[a]), i % s->axes[a].n));
+			i /= s->axes[a].n;
+		}
+		fprintf(fp, "%.6g,%.6g\n", points[p].lyapunov, points[p].bounded);
+		if(points[p].lyapunov > maxPositive) maxPositive = points[p].lyapunov;
+		if(-points[p].lyapunov > maxNegative) maxNegative = -points[p].lyapunov;
+	}
+	if(fclose(fp)) {
+		fprintf(stderr, "Error writing %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	printf("Wrote %zu sweep points to %s\n", nPoints, filename);
+
+	unsigned int width = s->axes[0].n;
+	unsigned int height = (s->nAxes > 1) ? s->axes[1].n : 1;
+	unsigned char *rgb = (unsigned char*)malloc(3 * nPoints);
+	if(rgb == NULL) {
+		fprintf(stderr, "Error allocating a %ux%u sweep map\n", width, height);
+		return EXIT_FAILURE;
+	}
+	for(size_t p = 0; p < nPoints; p++) sweepColour(&(points[p]), maxPositive, maxNegative, &(rgb[3*p]));
+	snprintf(filename, MAXPATHLENGTH, "%s/sweep.ppm", outputDir);
+	// rows are stored from the first value of the second axis, which goes at the bottom
+	int status = writePPM(filename, rgb, width, height, 1);
+	free(rgb);
+	return status;
+}
@@ -0,0 +1,57 @@
+// Parameter sweeps: the largest Lyapunov exponent of the flow, and whether it stays bounded,
+// over a grid of values of one or two coefficients. Each point of the grid is a small cloud of
+// particle pairs, one group of a cpu integrator ensemble, so thousands of points are advanced
+// by a single parallel integration with the kernels specialized to the flow.
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stddef.h>
+
+#include "Attractor.h"
+#include "CpuIntegrator.h"
+
+#define MAXSWEEPAXES 2
+#define MAXSWEEPNAME 32
+
+// n values of one coefficient, from min to max inclusive
+typedef struct {
+	char name[MAXSWEEPNAME]; // as given, "dy:x"
+	unsigned int coordinate; // 0: dx, 1: dy, 2: dz
+	unsigned int term;
+	float min;
+	float max;
+	unsigned int n;
+} sweepAxis;
+
+typedef struct {
+	unsigned int nAxes; // 0: no sweep
+	sweepAxis axes[MAXSWEEPAXES];
+	unsigned int cloudSize; // particles per point, the second half perturbed copies of the first
+	float transient; // simulated time before the exponent is measured
+	float time; // simulated time the exponent is averaged over
+} sweepSettings;
+
+typedef struct {
+	float lyapunov; // mean over the pairs which stayed bounded, NaN if none did
+	float bounded; // fraction of the pairs which stayed bounded
+} sweepPoint;
+
+void sweepDefaults(sweepSettings *s);
+
+// "dy:x=20:40:256" sweeps the x term of dy over 256 values from 20 to 40
+int sweepParseAxis(const char *spec, sweepAxis *axis);
+
+// Points of the grid, the first axis varying fastest
+size_t sweepPoints(const sweepSettings *s);
+
+// Integrate every point of the grid around the flow base, from uniform random positions in
+// [-volSize,volSize]^3. Resizes ci to the points integrated at once.
+int sweepRun(const sweepSettings *s, cpuIntegrator *ci, const attractorParameters *base, unsigned int integrator,
+	float stepSize, float tolerance, float volSize, unsigned int seed, sweepPoint *points);
+
+// sweep.csv, a line per point, and sweep.ppm, a map of the exponent with the first axis across
+// and the second upwards
+int sweepWrite(const sweepSettings *s, const sweepPoint *points, const char *outputDir);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ThreadPool.h"
+
+typedef struct {
+	threadPool *pool;
+	unsigned int index;
+} workerArgs;
+
+
+
+static void threadPoolRange(threadPool *pool, unsigned int index, size_t *begin, size_t *end)
+{
+	size_t nGrains = (pool->n + pool->grain - 1) / pool->grain;
+	size_t grainsPerThread = nGrains / pool->nThreads;
+	size_t extra = nGrains % pool->nThreads;
+	size_t first = index * grainsPerThread + (index < extra ? index : extra);
+	size_t count = grainsPerThread + (index < extra ? 1 : 0);
+
+	*begin = first * pool->grain;
+	*end = (first + count) * pool->grain;
+	if(*begin > pool->n) *begin = pool->n;
+	if(*end > pool->n) *end = pool->n;
+}
+
+
+
+static void *threadPoolWorker(void *arg)
+{
+	workerArgs *wa = (workerArgs*)arg;
+	threadPool *pool = wa->pool;
+	unsigned int index = wa->index;
+	free(wa);
+
+	unsigned long seenGeneration = 0;
+	pthread_mutex_lock(&(pool->mutex));
+	while(1) {
+		while(!pool->shutdown && pool->generation == seenGeneration) {
+			pthread_cond_wait(&(pool->workReady), &(pool->mutex));
+		}
+		if(pool->shutdown) break;
+		seenGeneration = pool->generation;
+		pthread_mutex_unlock(&(pool->mutex));
+
+		size_t begin, end;
+		threadPoolRange(pool, index, &begin, &end);
+		if(begin < end) pool->task(pool->arg, begin, end, index);
+
+		pthread_mutex_lock(&(pool->mutex));
+		if(--(pool->remaining) == 0) pthread_cond_signal(&(pool->workDone));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+	return NULL;
+}
+
+
+
+int threadPoolInit(threadPool *pool, unsigned int nThreads)
+{
+	if(nThreads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		nThreads = (online > 0) ? (unsigned int)online : 1;
+	}
+	pool->nThreads = nThreads;
+	pool->generation = 0;
+	pool->remaining = 0;
+	pool->shutdown = 0;
+	pthread_mutex_init(&(pool->mutex), NULL);
+	pthread_cond_init(&(pool->workReady), NULL);
+	pthread_cond_init(&(pool->workDone), NULL);
+
+	// thread 0 is the caller of threadPoolParallelFor
+	pool->threads = (pthread_t*)malloc(nThreads * sizeof(pthread_t));
+	for(unsigned int i = 1; i < nThreads; i++) {
+		workerArgs *wa = (workerArgs*)malloc(sizeof(workerArgs));
+		wa->pool = pool;
+		wa->index = i;
+		if(pthread_create(&(pool->threads[i]), NULL, threadPoolWorker, wa)) {
+			fprintf(stderr, "Error creating worker thread %u\n", i);
+			free(wa);
+			pool->nThreads = i;
+			break;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+void threadPoolFree(threadPool *pool)
+{
+	pthread_mutex_lock(&(pool->mutex));
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&(pool->workReady));
+	pthread_mutex_unlock(&(pool->mutex));
+	for(unsigned int i = 1; i < pool->nThreads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+	pthread_mutex_destroy(&(pool->mutex));
+	pthread_cond_destroy(&(pool->workReady));
+	pthread_cond_destroy(&(pool->workDone));
+}
+
+
+
+void threadPoolParallelFor(threadPool *pool, size_t n, size_t grain, threadPoolTask task, void *arg)
+{
+	if(grain == 0) grain = 1;
+
+	// not worth waking the workers
+	if(pool->nThreads == 1 || n <= grain) {
+		if(n > 0) task(arg, 0, n, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	pool->task = task;
+	pool->arg = arg;
+	pool->n = n;
+	pool->grain = grain;
+	pool->remaining = pool->nThreads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&(pool->workReady));
+	pthread_mutex_unlock(&(pool->mutex));
+
+	size_t begin, end;
+	threadPoolRange(pool, 0, &begin, &end);
+	if(begin < end) task(arg, begin, end, 0);
+
+	pthread_mutex_lock(&(pool->mutex));
+	while(pool->remaining > 0) {
+		pthread_cond_wait(&(pool->workDone), &(pool->mutex));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+}
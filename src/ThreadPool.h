@@ -0,0 +1,37 @@
+// Persistent pthread worker pool with a blocking parallel-for
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Work function: process items [begin,end). threadIndex is in [0,nThreads)
+typedef void (*threadPoolTask)(void *arg, size_t begin, size_t end, unsigned int threadIndex);
+
+typedef struct {
+	unsigned int nThreads; // including the calling thread
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t workReady;
+	pthread_cond_t workDone;
+	unsigned long generation;
+	unsigned int remaining;
+	int shutdown;
+
+	// current job
+	threadPoolTask task;
+	void *arg;
+	size_t n;
+	size_t grain;
+} threadPool;
+
+// nThreads = 0 uses all online cpus
+int threadPoolInit(threadPool *pool, unsigned int nThreads);
+void threadPoolFree(threadPool *pool);
+
+// Split [0,n) into one contiguous range per thread, range boundaries are multiples of grain.
+// The calling thread works on range 0 and returns when all ranges are complete.
+void threadPoolParallelFor(threadPool *pool, size_t n, size_t grain, threadPoolTask task, void *arg);
+
+#endif
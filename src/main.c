@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include <iostream>
 
@@ -15,62 +19,449 @@
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#ifndef FOROSX
+// headless contexts, without a window system
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 #define OGLLOGSIZE 512
 
 #include "GetWallTime.h"
-
-#define NPARTICLES 2500000
-#define NPARAMETERS 10
+#include "Attractor.h"
+#include "CpuIntegrator.h"
+#include "GpuTimer.h"
+#include "FrameProfiler.h"
+#include "Readback.h"
+#include "Snapshot.h"
+#include "FrameWriter.h"
+#include "Sweep.h"
+#include "Reference.h"
+
+#define DEFAULTNPARTICLES 2500000
+#define MINNPARTICLES 1024
 #define ROTATIONDELTA 0.01f
 #define MOVEMENTDELTA 0.01f
 #define MOUSESENSITIVITY 0.005f
+#define MAXKEYPRESSES 32 // queued between frames, later ones are dropped
+#define VIEWBLOCKBINDING 0
 #define CUBESIZE 1.0f
 #define MAXTEXTLENGTH 256
-
-const char *vertexShaderSource = "#version 330 core\n"
+// HUD lines: the status at the bottom, the profiler from the top
+#define MAXTEXTLINES 16
+#define TEXTLINESTATUS 0
+#define TEXTLINEATTRACTOR 1
+#define TEXTLINEPROFILE 2
+#define TEXTLINEHEIGHT (72.0f/2048.0f) // 60 pixel glyphs and a gap, as setText scales them
+#define MAXPATHLENGTH 1024
+#define CHECKPOINTCHUNK 16384 // particles interleaved per write
+#define MAXBENCHVALUES 16
+#define INTEGRATECACHESIZE 8 // specialized integration programs kept, least recently used replaced
+#define VELOCITYSOURCELENGTH 4096
+#define PRELUDESOURCELENGTH 512
+#define DEFAULTWORKGROUPSIZE 64 // compute shader work group size before, or without, a trial
+#define WORKGROUPTRIALPARTICLES (1 << 18)
+#define MAXDISPATCHCOLUMNS 65535 // work groups across a compute dispatch, the smallest limit allowed
+#define GROUPFLOATS 64 // per ensemble group in groupTBO: X, Y, Z, then relative scale and translation
+#define GROUPTEXTUREUNIT 1
+#define POSITIONTEXTUREUNIT 2 // the integration input, read when respawning
+#define TRAILTEXTUREUNIT 3
+#define DEFAULTTRAILLENGTH 32 // past positions per trail, when shown with v
+#define DEFAULTTRAILMEMORY 256 // MB for the trails, which sample fewer particles to fit
+#define LODPARTICLESPERPIXEL 16 // culling draws fewer particles beyond this many per pixel of the cube
+#define MAXLODSTRIDE 64
+#define RESPAWNBOUND 100.0f // particles further than this times the initial volume are respawned
+#define DEFAULTSTEPSIZE 0.001f // unless the attractor recommends one
+#define RELOADINTERVAL 1.0 // s between checks for edits of the attractor definitions
+#define MAXFRAMETIME 0.1 // s, longer frames slow the simulation down rather than piling up steps
+#define REFERENCEFPS 60.0 // default simulation rate is updatesPerFrame steps per frame at this rate
+#define DEFAULTVALIDATEPARTICLES 1024
+#define VALIDATESUBSTEPS 16 // reference steps per smallest validated step
+#define VALIDATEDIVERGED 0.01 // particles further than this times the scale factor from the reference
+
+// Backends which advance the particles
+#define BACKEND_GPU 0
+#define BACKEND_CPU 1
+
+// Formats of the positions the cpu backend uploads for drawing
+#define STORAGE_FLOAT 0
+#define STORAGE_HALF 1
+
+// How particles are drawn: alpha-blended points, or counted per pixel and tone-mapped
+#define RENDER_POINTS 0
+#define RENDER_DENSITY 1
+#define DENSITYPEAK 256.0 // density, relative to the mean, at which the tone map saturates
+
+// Sections timed with GL queries by the benchmark
+#define BENCHGPUINTEGRATE 0
+#define BENCHGPUDRAW 1
+#define BENCHGPUNSECTIONS 2
+
+// Phases of an interactive frame, timed by the profiler
+#define PROFILEINPUT 0
+#define PROFILEUNIFORMS 1
+#define PROFILEINTEGRATE 2
+#define PROFILECUBE 3
+#define PROFILEPARTICLES 4
+#define PROFILETEXT 5
+#define PROFILESWAP 6
+#define PROFILENPHASES 7
+const char *const profilePhaseNames[PROFILENPHASES] = {"input", "uniforms", "integrate", "cube", "particles", "text", "swap"};
+const unsigned int profilePhaseGpu[PROFILENPHASES] = {0, 0, 1, 1, 1, 1, 0};
+
+// Long-only command line options
+#define OPTBENCHPARTICLES 256
+#define OPTBENCHUPDATES 257
+#define OPTBENCHBACKENDS 258
+#define OPTBENCHFRAMES 259
+#define OPTBENCHTIME 260
+#define OPTTOLERANCE 261
+#define OPTSIMRATE 262
+#define OPTNOVSYNC 263
+#define OPTSTORAGE 264
+#define OPTSEED 265
+#define OPTTRAJECTORY 266
+#define OPTRESTORE 267
+#define OPTCHECKPOINT 268
+#define OPTRECORDPIPE 269
+#define OPTRECORDRESOLUTION 270
+#define OPTRENDER 271
+#define OPTACCUMULATE 272
+#define OPTATTRACTORS 273
+#define OPTENSEMBLE 274
+#define OPTSWEEP 275
+#define OPTSWEEPTIME 276
+#define OPTSWEEPTRANSIENT 277
+#define OPTSWEEPPARTICLES 278
+#define OPTNORESPAWN 279
+#define OPTPROFILE 280
+#define OPTCOMPUTE 281
+#define OPTWORKGROUPSIZE 282
+#define OPTTRAILS 283
+#define OPTTRAILMEMORY 284
+#define OPTCULL 285
+#define OPTVALIDATE 286
+#define OPTVALIDATESTEPS 287
+#define OPTVALIDATEPARTICLES 288
+#define OPTVALIDATETIME 289
+#define OPTREFERENCE 290
+
+// The particle shaders are assembled from the version line, the flow and a main()
+const char *shaderVersionSource = "#version 330 core\n";
+const char *computeVersionSource = "#version 430 core\n";
+
+// The view, one uniform buffer shared by the particle, cull and cube programs, see viewBlock
+const char *viewBlockSource =
+	"layout (std140) uniform View {\n"
+	"	mat4 rotationMatrix;\n"
+	"	mat4 translationMatrix;\n"
+	"	mat4 cameraMatrix;\n"
+	"	mat4 perspectiveMatrix;\n"
+	"	float scaleFactor;\n"
+	"	int groupColumns;\n"
+	"};\n";
+
+// The flow of the render program. In an ensemble each group of groupSize particles has its own,
+// fetched by loadFlow() from the groups texture along with its placement.
+const char *velocityShaderSource =
+	"uniform float flowX[20];\n"
+	"uniform float flowY[20];\n"
+	"uniform float flowZ[20];\n"
+	"uniform int degree;\n"
+	"uniform int groupSize;\n"
+	"uniform samplerBuffer groups;\n"
+	"float X[20];\n"
+	"float Y[20];\n"
+	"float Z[20];\n"
+	"vec4 groupView;\n"
+	""
+	"void loadFlow(int particle)\n"
+	"{\n"
+	"	if(groupSize == 0) {\n"
+	"		X = flowX;\n"
+	"		Y = flowY;\n"
+	"		Z = flowZ;\n"
+	"		return;\n"
+	"	}\n"
+	"	int base = 64*(particle / groupSize);\n"
+	"	for(int i = 0; i < 20; i++) {\n"
+	"		X[i] = texelFetch(groups, base + i).r;\n"
+	"		Y[i] = texelFetch(groups, base + 20 + i).r;\n"
+	"		Z[i] = texelFetch(groups, base + 40 + i).r;\n"
+	"	}\n"
+	"	groupView = vec4(texelFetch(groups, base + 60).r, texelFetch(groups, base + 61).r,\n"
+	"		texelFetch(groups, base + 62).r, texelFetch(groups, base + 63).r);\n"
+	"}\n"
+	""
+	"vec3 velocity(vec3 p)\n"
+	"{\n"
+	"	float x = p.x;\n"
+	"	float y = p.y;\n"
+	"	float z = p.z;\n"
+	"	vec3 v = vec3(\n"
+	"		X[0] + X[1]*x + X[2]*y + X[3]*z + X[4]*x*x + X[5]*x*y + X[6]*x*z + X[7]*y*y + X[8]*y*z + X[9]*z*z,\n"
+	"		Y[0] + Y[1]*x + Y[2]*y + Y[3]*z + Y[4]*x*x + Y[5]*x*y + Y[6]*x*z + Y[7]*y*y + Y[8]*y*z + Y[9]*z*z,\n"
+	"		Z[0] + Z[1]*x + Z[2]*y + Z[3]*z + Z[4]*x*x + Z[5]*x*y + Z[6]*x*z + Z[7]*y*y + Z[8]*y*z + Z[9]*z*z);\n"
+	"	if(degree > 2) {\n"
+	"		vec3 c = vec3(x*x*x, x*x*y, x*x*z);\n"
+	"		vec3 d = vec3(x*y*y, x*y*z, x*z*z);\n"
+	"		vec3 e = vec3(y*y*y, y*y*z, y*z*z);\n"
+	"		float zzz = z*z*z;\n"
+	"		v += vec3(\n"
+	"			dot(vec3(X[10], X[11], X[12]), c) + dot(vec3(X[13], X[14], X[15]), d) + dot(vec3(X[16], X[17], X[18]), e) + X[19]*zzz,\n"
+	"			dot(vec3(Y[10], Y[11], Y[12]), c) + dot(vec3(Y[13], Y[14], Y[15]), d) + dot(vec3(Y[16], Y[17], Y[18]), e) + Y[19]*zzz,\n"
+	"			dot(vec3(Z[10], Z[11], Z[12]), c) + dot(vec3(Z[13], Z[14], Z[15]), d) + dot(vec3(Z[16], Z[17], Z[18]), e) + Z[19]*zzz);\n"
+	"	}\n"
+	"	return v;\n"
+	"}\n";
+
+// Monomials in the order of NPARAMETERS, for the specialized velocity of the integration programs
+const char *monomialSources[NPARAMETERS] = {"", "*x", "*y", "*z", "*x*x", "*x*y", "*x*z", "*y*y", "*y*z", "*z*z",
+	"*x*x*x", "*x*x*y", "*x*x*z", "*x*y*y", "*x*y*z", "*x*z*z", "*y*y*y", "*y*y*z", "*y*z*z", "*z*z*z"};
+
+// Integration of one particle, shared by the transform feedback and compute programs, which
+// define PARTICLEID. Compiled after a velocity() specialized to the flow, see useIntegrateProgram.
+// Particles which end a pass beyond bound, or not a number, are respawned: next to a random
+// particle of the same flow if that one is fine, otherwise in the initial volume. With
+// COUNTRESPAWNS each respawn increments an atomic counter.
+const char *integrateShaderSource =
+	"uniform float stepSize;\n"
+	"uniform int updatesPerFrame;\n"
+	"uniform int integrator;\n" // 0: euler, 1: rk4, 2: rk45
+	"uniform float tolerance;\n"
+	"uniform float bound;\n" // 0: never respawn
+	"uniform float volSize;\n"
+	"uniform uint seed;\n"
+	"uniform uint respawnStream;\n"
+	"uniform int nPositions;\n" // particles readable from positions
+	"uniform samplerBuffer positions;\n" // the input, as floats
+	"#ifdef COUNTRESPAWNS\n"
+	"layout (binding = 0, offset = 0) uniform atomic_uint respawned;\n"
+	"#endif\n"
+	""
+	"bool escaped(vec3 p)\n"
+	"{\n"
+	"	return any(isnan(p)) || any(greaterThanEqual(abs(p), vec3(bound)));\n"
+	"}\n"
+	""
+	"vec3 respawn()\n"
+	"{\n"
+	"	uvec4 c = philox(uvec4(uint(PARTICLEID), 1u, respawnStream, 0u), uvec2(seed, 0u));\n"
+	"	vec3 u = 2.0f*vec3(c.xyz >> 8u)*(1.0f/16777216.0f) - 1.0f;\n"
+	"	int groupFirst = (groupSize > 0) ? groupSize*(PARTICLEID / groupSize) : 0;\n"
+	"	int groupCount = (groupSize > 0) ? min(groupSize, nPositions - groupFirst) : nPositions;\n"
+	"#ifdef COUNTRESPAWNS\n"
+	"	atomicCounterIncrement(respawned);\n"
+	"#endif\n"
+	"	if(groupCount > 0) {\n"
+	"		int j = groupFirst + int(c.w % uint(groupCount));\n"
+	"		vec3 q = vec3(texelFetch(positions, 3*j).r, texelFetch(positions, 3*j+1).r, texelFetch(positions, 3*j+2).r);\n"
+	"		if(!escaped(q)) return q + 1e-3f*volSize*u;\n"
+	"	}\n"
+	"	return volSize*u;\n"
+	"}\n"
+	""
+	"vec3 integrate(vec3 p, float stepIn, out float stepOut)\n"
+	"{\n"
+	"	int i;\n"
+	"	stepOut = stepIn;\n"
+	""
+	"	if(integrator == 0) {\n"
+	"		for(i = 0; i < updatesPerFrame; i++) {\n"
+	"			p += stepSize*velocity(p);\n"
+	"		}\n"
+	"	}\n"
+	"	else if(integrator == 1) {\n"
+	"		for(i = 0; i < updatesPerFrame; i++) {\n"
+	"			vec3 k1 = velocity(p);\n"
+	"			vec3 k2 = velocity(p + 0.5f*stepSize*k1);\n"
+	"			vec3 k3 = velocity(p + 0.5f*stepSize*k2);\n"
+	"			vec3 k4 = velocity(p + stepSize*k3);\n"
+	"			p += stepSize/6.0f * (k1 + 2.0f*k2 + 2.0f*k3 + k4);\n"
+	"		}\n"
+	"	}\n"
+	"	else {\n"
+	// Dormand-Prince 5(4): advance by updatesPerFrame*stepSize in time, with this particle's
+	// own step size carried between frames. At most 4*updatesPerFrame+64 attempts per frame.
+	"		float T = stepSize*float(updatesPerFrame);\n"
+	"		float t = 0.0f;\n"
+	"		float h = (stepIn > 0.0f) ? stepIn : stepSize;\n"
+	"		vec3 vel = velocity(p);\n"
+	"		for(i = 0; i < 4*updatesPerFrame + 64 && t < T; i++) {\n"
+	"			float hs = min(h, T-t);\n"
+	"			vec3 k2 = velocity(p + hs*((1.0f/5.0f)*vel));\n"
+	"			vec3 k3 = velocity(p + hs*((3.0f/40.0f)*vel + (9.0f/40.0f)*k2));\n"
+	"			vec3 k4 = velocity(p + hs*((44.0f/45.0f)*vel - (56.0f/15.0f)*k2 + (32.0f/9.0f)*k3));\n"
+	"			vec3 k5 = velocity(p + hs*((19372.0f/6561.0f)*vel - (25360.0f/2187.0f)*k2 + (64448.0f/6561.0f)*k3 - (212.0f/729.0f)*k4));\n"
+	"			vec3 k6 = velocity(p + hs*((9017.0f/3168.0f)*vel - (355.0f/33.0f)*k2 + (46732.0f/5247.0f)*k3 + (49.0f/176.0f)*k4 - (5103.0f/18656.0f)*k5));\n"
+	"			vec3 p5 = p + hs*((35.0f/384.0f)*vel + (500.0f/1113.0f)*k3 + (125.0f/192.0f)*k4 - (2187.0f/6784.0f)*k5 + (11.0f/84.0f)*k6);\n"
+	"			vec3 k7 = velocity(p5);\n"
+	"			vec3 e = hs*((71.0f/57600.0f)*vel - (71.0f/16695.0f)*k3 + (71.0f/1920.0f)*k4 - (17253.0f/339200.0f)*k5 + (22.0f/525.0f)*k6 - (1.0f/40.0f)*k7);\n"
+	"			vec3 r = abs(e) / (tolerance * (1.0f + max(abs(p), abs(p5))));\n"
+	"			float err = max(r.x, max(r.y, r.z));\n"
+	"			float factor = clamp(0.9f*pow(max(err, 1e-10f), -0.2f), 0.2f, 5.0f);\n"
+	"			if(err <= 1.0f || hs <= 1e-3f*stepSize) {\n"
+	"				t += hs;\n"
+	"				p = p5;\n"
+	"				vel = k7;\n"
+	"				if(hs < h) continue;\n" // shortened to land on T, keep h
+	"			}\n"
+	"			h = hs*factor;\n"
+	"		}\n"
+	"		stepOut = h;\n"
+	"	}\n"
+	"	if(bound > 0.0f && escaped(p)) {\n"
+	"		p = respawn();\n"
+	"		stepOut = 0.0f;\n"
+	"	}\n"
+	"	return p;\n"
+	"}\n";
+
+// Transform feedback, run with the rasterizer discarded: no projection, no fragments. The
+// input pair of buffers is read as attributes and the other pair captured.
+const char *vertexIntegrateSource =
 	"layout (location = 0) in vec3 pos;\n"
+	"layout (location = 1) in float stepIn;\n"
 	"out vec3 posNew;\n"
-	"out vec4 colour;\n"
+	"out float stepNew;\n"
+	""
+	"void main()\n"
+	"{\n"
+	"	loadFlow();\n"
+	"	posNew = integrate(pos, stepIn, stepNew);\n"
+	"}\0";
+
+// Compute shaders update the particles in place, count of them from first, through storage
+// buffers bound at the first of them. The grid is 2-D so any count fits the work group limits.
+const char *computeIntegrateSource =
+	"layout (std430, binding = 0) buffer positionBlock { float position[]; };\n"
+	"#ifdef ADAPTIVE\n"
+	"layout (std430, binding = 1) buffer stepBlock { float steps[]; };\n"
+	"#endif\n"
 	""
-	"uniform float scaleFactor;\n"
-	"uniform mat4 rotationMatrix;\n"
-	"uniform mat4 translationMatrix;\n"
-	"uniform mat4 cameraMatrix;\n"
-	"uniform mat4 perspectiveMatrix;\n"
+	"void main()\n"
+	"{\n"
+	"	int i = PARTICLEINDEX;\n"
+	"	if(i >= count) return;\n"
+	"	loadFlow();\n"
+	"	vec3 p = vec3(position[3*i], position[3*i+1], position[3*i+2]);\n"
+	"#ifdef ADAPTIVE\n"
+	"	float stepIn = steps[i];\n"
+	"#else\n"
+	"	float stepIn = 0.0f;\n"
+	"#endif\n"
+	"	float stepNew;\n"
+	"	p = integrate(p, stepIn, stepNew);\n"
+	"	position[3*i] = p.x;\n"
+	"	position[3*i+1] = p.y;\n"
+	"	position[3*i+2] = p.z;\n"
+	"#ifdef ADAPTIVE\n"
+	"	steps[i] = stepNew;\n"
+	"#endif\n"
+	"}\0";
+
+// Philox4x32-10, the same generator as randomKernel in CpuIntegratorKernels.inc
+const char *philoxShaderSource =
+	// high word of a 32x32 bit product, from 16 bit halves
+	"uint mulhi(uint a, uint b)\n"
+	"{\n"
+	"	uint al = a & 0xffffu;\n"
+	"	uint ah = a >> 16;\n"
+	"	uint bl = b & 0xffffu;\n"
+	"	uint bh = b >> 16;\n"
+	"	uint lh = al*bh;\n"
+	"	uint hl = ah*bl;\n"
+	"	uint mid = ((al*bl) >> 16) + (lh & 0xffffu) + (hl & 0xffffu);\n"
+	"	return ah*bh + (lh >> 16) + (hl >> 16) + (mid >> 16);\n"
+	"}\n"
 	""
-	"uniform float X[10];\n"
-	"uniform float Y[10];\n"
-	"uniform float Z[10];\n"
+	"uvec4 philox(uvec4 c, uvec2 k)\n"
+	"{\n"
+	"	for(int r = 0; r < 10; r++) {\n"
+	"		uint hi0 = mulhi(0xD2511F53u, c.x);\n"
+	"		uint hi1 = mulhi(0xCD9E8D57u, c.z);\n"
+	"		c = uvec4(hi1 ^ c.y ^ k.x, 0xCD9E8D57u*c.z, hi0 ^ c.w ^ k.y, 0xD2511F53u*c.x);\n"
+	"		k += uvec2(0x9E3779B9u, 0xBB67AE85u);\n"
+	"	}\n"
+	"	return c;\n"
+	"}\n";
+
+// Random initial positions, written by transform feedback with the rasterizer discarded.
+// Philox with counter (gl_VertexID, 0, stream, 0) and key (seed, 0), as on the cpu, so both
+// backends start from the same state.
+const char *vertexShaderInitSource =
+	"out vec3 posNew;\n"
 	""
-	"uniform float stepSize;\n"
-	"uniform int updatesPerFrame;\n"
+	"uniform uint seed;\n"
+	"uniform uint stream;\n"
+	"uniform float volSize;\n"
 	""
 	"void main()\n"
 	"{\n"
-	"	float velx;\n"
-	"	float vely;\n"
-	"	float velz;\n"
-	"	float x = pos.x;\n"
-	"	float y = pos.y;\n"
-	"	float z = pos.z;\n"
-	"	int i;\n"
+	"	uvec4 c = philox(uvec4(uint(gl_VertexID), 0u, stream, 0u), uvec2(seed, 0u));\n"
+	"	posNew = volSize*(2.0f*vec3(c.xyz >> 8u)*(1.0f/16777216.0f) - 1.0f);\n"
+	"}\0";
+
+// One point of every trail: the current position of every stride-th particle, gathered from
+// the positions texture into a slot of the trail ring by transform feedback
+const char *vertexShaderTrailSource = "#version 330 core\n"
+	"out vec3 posNew;\n"
 	""
-	"	for(i = 0; i < updatesPerFrame; i++) {\n"
-	"		velx = X[0] + X[1]*x + X[2]*y + X[3]*z + X[4]*x*x + X[5]*x*y + X[6]*x*z + X[7]*y*y + X[8]*y*z + X[9]*z*z;\n"
-	"		vely = Y[0] + Y[1]*x + Y[2]*y + Y[3]*z + Y[4]*x*x + Y[5]*x*y + Y[6]*x*z + Y[7]*y*y + Y[8]*y*z + Y[9]*z*z;\n"
-	"		velz = Z[0] + Z[1]*x + Z[2]*y + Z[3]*z + Z[4]*x*x + Z[5]*x*y + Z[6]*x*z + Z[7]*y*y + Z[8]*y*z + Z[9]*z*z;\n"
-	"		x += stepSize*velx;\n"
-	"		y += stepSize*vely;\n"
-	"		z += stepSize*velz;\n"
-	"	};\n"
+	"uniform samplerBuffer positions;\n"
+	"uniform int stride;\n"
+	""
+	"void main()\n"
+	"{\n"
+	"	int i = 3*gl_VertexID*stride;\n"
+	"	posNew = vec3(texelFetch(positions, i).r, texelFetch(positions, i + 1).r, texelFetch(positions, i + 2).r);\n"
+	"}\0";
+
+// Drawing only, coloured by the speed at the current position. With density set each
+// particle instead adds one to the pixel it falls in. The groups of an ensemble are laid out
+// side by side, in a grid of groupColumns across the front of the cube.
+// With trailLength set each instance is the trail of a particle instead, a line strip through
+// its past positions in the trail ring, newest first and fading with age.
+// Culling draws every lodStride-th particle through the cull program, which keeps those in the
+// view, then draws those with culled set, made more opaque to stand in for the ones skipped.
+const char *vertexShaderSource =
+	"layout (location = 0) in vec3 pos;\n"
+	"layout (location = 2) in int culledIndex;\n"
+	"out vec4 colour;\n"
+	"out vec3 vertexPosition;\n"
+	"flat out int vertexParticle;\n"
 	""
-	"	posNew.x = x;\n"
-	"	posNew.y = y;\n"
-	"	posNew.z = z;\n"
+	"uniform int density;\n"
+	"uniform int culled;\n"
+	"uniform int lodStride;\n"
+	"uniform int trailLength;\n"
+	"uniform int trailHead;\n"
+	"uniform int trailParticles;\n"
+	"uniform int trailStride;\n"
+	"uniform samplerBuffer trail;\n"
 	""
-	"	float speed = length(vec3(velx,vely,velz));\n"
+	"void main()\n"
+	"{\n"
+	"	int particle = (culled != 0) ? culledIndex : gl_VertexID*lodStride;\n"
+	"	vec3 position = pos;\n"
+	"	float age = 0.0f;\n"
+	"	if(trailLength > 0) {\n"
+	"		particle = gl_InstanceID*trailStride;\n"
+	"		int i = 3*(((trailHead - gl_VertexID + trailLength) % trailLength)*trailParticles + gl_InstanceID);\n"
+	"		position = vec3(texelFetch(trail, i).r, texelFetch(trail, i + 1).r, texelFetch(trail, i + 2).r);\n"
+	"		age = float(gl_VertexID)/float(trailLength);\n"
+	"	}\n"
+	"	loadFlow(particle);\n"
+	"	float speed = length(velocity(position));\n"
 	""
-	"	gl_Position = cameraMatrix * translationMatrix * rotationMatrix * vec4(posNew/scaleFactor, 1.0);\n"
+	"	if(groupSize > 0) {\n"
+	"		int group = particle / groupSize;\n"
+	"		float cell = 2.0f/float(groupColumns);\n"
+	"		vec3 centre = vec3(-1.0f + cell*(float(group % groupColumns) + 0.5f), 1.0f - cell*(float(group / groupColumns) + 0.5f), 0.0f);\n"
+	"		vec4 p = rotationMatrix * vec4(position/(scaleFactor*groupView.x), 1.0);\n"
+	"		gl_Position = cameraMatrix * vec4((p.xyz + groupView.yzw)/float(groupColumns) + centre, 1.0);\n"
+	"	}\n"
+	"	else {\n"
+	"		gl_Position = cameraMatrix * translationMatrix * rotationMatrix * vec4(position/scaleFactor, 1.0);\n"
+	"	}\n"
 	"	float cameraDistance = -gl_Position.z;\n"
 	"	gl_Position = perspectiveMatrix * gl_Position;\n"
 	"	gl_PointSize = 4.0f/(1.0f+cameraDistance);\n"
@@ -78,6 +469,36 @@ const char *vertexShaderSource = "#version 330 core\n"
 	"		+ vec3(40.0f/255.0f, 0.0f, 100.0f/255.0f)\n"
 	"		+ 100.0/speed * vec3(225.0f/255.0f, 100.0f/255.0f, 0.0f)\n"
 	"		, 0.05f/(1.0f+cameraDistance));\n"
+	"	colour.a *= 1.0f - age;\n"
+	"	if(lodStride > 1) {\n"
+	"		colour.a = 1.0f - pow(1.0f - colour.a, float(lodStride));\n"
+	"	}\n"
+	"	vertexPosition = position;\n"
+	"	vertexParticle = particle;\n"
+	"	if(density != 0) {\n"
+	"		gl_PointSize = 1.0f;\n"
+	"		colour = vec4(1.0f);\n"
+	"	}\n"
+	"}\0";
+
+// Frustum culling, after the render vertex shader: only points inside the clip volume, which
+// are the ones a draw would rasterize, are emitted and captured by transform feedback
+const char *geometryShaderCullSource = "#version 330 core\n"
+	"layout (points) in;\n"
+	"layout (points, max_vertices = 1) out;\n"
+	"in vec3 vertexPosition[];\n"
+	"flat in int vertexParticle[];\n"
+	"out vec3 culledPos;\n"
+	"flat out int culledParticle;\n"
+	""
+	"void main()\n"
+	"{\n"
+	"	vec4 p = gl_in[0].gl_Position;\n"
+	"	if(all(lessThanEqual(abs(p.xyz), vec3(p.w)))) {\n"
+	"		culledPos = vertexPosition[0];\n"
+	"		culledParticle = vertexParticle[0];\n"
+	"		EmitVertex();\n"
+	"	}\n"
 	"}\0";
 
 const char *fragmentShaderSource = "#version 330 core\n"
@@ -88,10 +509,8 @@ const char *fragmentShaderSource = "#version 330 core\n"
 	"   FragColor = colour;\n"
 	"}\0";
 
-const char *vertexShaderCubeSource = "#version 330 core\n"
+const char *vertexShaderCubeSource =
 	"layout (location = 0) in vec3 pos;\n"
-	"uniform mat4 cameraMatrix;\n"
-	"uniform mat4 perspectiveMatrix;\n"
 	"out vec4 colour;\n"
 	""
 	"void main()\n"
@@ -111,6 +530,52 @@ const char *fragmentShaderCubeSource = "#version 330 core\n"
 	"	FragColor = colour;\n"
 	"}\0";
 
+// fullscreen triangle from gl_VertexID, showing an offscreen frame in the window
+const char *vertexShaderCopySource = "#version 330 core\n"
+	"out vec2 TextureCoords;\n"
+	""
+	"void main()\n"
+	"{\n"
+	"	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+	"	gl_Position = vec4(2.0f*corner - 1.0f, 0.0f, 1.0f);\n"
+	"	TextureCoords = corner;\n"
+	"}\0";
+
+const char *fragmentShaderCopySource = "#version 330 core\n"
+	"in vec2 TextureCoords;\n"
+	"out vec4 FragColour;\n"
+	"uniform sampler2D frame;\n"
+	""
+	"void main()\n"
+	"{\n"
+	"	FragColour = vec4(texture(frame, TextureCoords).rgb, 1.0f);\n"
+	"}\0";
+
+// Tone map of the per-pixel particle counts, drawn with vertexShaderCopySource. The gpu
+// backend accumulates into a float texture, the cpu backend uploads integer counts.
+const char *toneMapFloatSource = "#version 330 core\n"
+	"uniform sampler2D density;\n"
+	"float densityAt(vec2 p) { return texture(density, p).r; }\n";
+
+const char *toneMapCountSource = "#version 330 core\n"
+	"uniform usampler2D density;\n"
+	"float densityAt(vec2 p) { return float(texture(density, p).r); }\n";
+
+const char *toneMapSource =
+	"in vec2 TextureCoords;\n"
+	"out vec4 FragColour;\n"
+	"uniform float inverseReference;\n" // 1 / mean count per pixel
+	"uniform float inverseLogPeak;\n"
+	""
+	"void main()\n"
+	"{\n"
+	"	float v = clamp(log(1.0f + densityAt(TextureCoords)*inverseReference) * inverseLogPeak, 0.0f, 1.0f);\n"
+	"	vec3 low = vec3(40.0f/255.0f, 0.0f, 100.0f/255.0f);\n"
+	"	vec3 high = vec3(225.0f/255.0f, 100.0f/255.0f, 0.0f);\n"
+	"	vec3 c = mix(low, high, v) * smoothstep(0.0f, 0.25f, v) + 0.5f*vec3(smoothstep(0.75f, 1.0f, v));\n"
+	"	FragColour = vec4(c, 1.0f);\n"
+	"}\0";
+
 const char *vertexShaderTextSource = "#version 330 core\n"
 	"layout (location = 0) in vec4 vertex;\n"
 	"out vec2 TextureCoords;\n"
@@ -133,32 +598,151 @@ const char *fragmentShaderTextSource = "#version 330 core\n"
 
 
 
+// An integration program with the coefficients of params compiled in as constants, or for
+// an ensemble with the terms non-zero in params fetched per group
+typedef struct {
+	unsigned int program;
+	attractorParameters params;
+	unsigned int ensemble;
+	unsigned int workgroupSize; // compute programs, 0: transform feedback
+	unsigned int firstLocation;
+	unsigned int countLocation;
+	unsigned int groupSizeLocation;
+	unsigned int stepSizeLocation;
+	unsigned int updatesPerFrameLocation;
+	unsigned int integratorLocation;
+	unsigned int boundLocation;
+	unsigned int volSizeLocation;
+	unsigned int seedLocation;
+	unsigned int respawnStreamLocation;
+	unsigned int nPositionsLocation;
+	unsigned long long lastUsed;
+} integrateProgram;
+
+// The contents of the View uniform block, in its std140 layout
+typedef struct {
+	glm::mat4 rotationMatrix;
+	glm::mat4 translationMatrix;
+	glm::mat4 cameraMatrix;
+	glm::mat4 perspectiveMatrix;
+	float scaleFactor;
+	int groupColumns;
+	float padding[2];
+} viewBlock;
+
 // Struct to hold opengl objects
 typedef struct {
 	GLFWwindow *window;
+#ifndef FOROSX
+	// headless: EGL context rendering into frameFBO
+	EGLDisplay eglDisplay;
+	EGLContext eglContext;
+#endif
+	unsigned int frameFBO, frameRBO;
+	size_t nParticles; // capacity of pos1VBO and pos2VBO
 	unsigned int vertexShader, fragmentShader, shaderProgram;
-	unsigned int VAO, pos1VBO, pos2VBO;
+	unsigned int vertexShaderInit, shaderProgramInit;
+	// VAO reads pos1VBO and step1VBO, VAO2 the other pair, and they swap with them.
+	// emptyVAO has no attributes, for passes which read none.
+	unsigned int VAO, VAO2, emptyVAO, pos1VBO, pos2VBO;
+	unsigned int step1VBO, step2VBO; // rk45 per-particle step size, 0 unless adaptive
+	unsigned int adaptive;
+	// cpu backend: pos1VBO is only a render copy, uploaded every frame, and pos2VBO is unused
+	unsigned int hostPositions;
+	unsigned int halfPositions; // render copy as 3 half floats
 	unsigned int vertexShaderCube, fragmentShaderCube, shaderProgramCube;
 	unsigned int cubeVAO, cubeVBO;
 	unsigned int vertexShaderText, fragmentShaderText, shaderProgramText;
 	unsigned int textVAO, textVBO;
-
-	// uniforms:
-	unsigned int scaleFactorLocation;
-	unsigned int rotationMatrixLocation;
-	unsigned int translationMatrixLocation;
-	unsigned int cameraMatrixLocation;
-	unsigned int perspectiveMatrixLocation;
+	// HUD text: each line is laid out into its own slot of textVBO only when it changes, and
+	// all of them are drawn with one call
+	char textLines[MAXTEXTLINES][MAXTEXTLENGTH];
+	float textPositions[MAXTEXTLINES][2];
+	GLint textFirst[MAXTEXTLINES];
+	GLsizei textCount[MAXTEXTLINES]; // vertices, 0: empty
+	unsigned int vertexShaderCopy, fragmentShaderCopy, shaderProgramCopy;
+	unsigned int vertexShaderToneMap, fragmentShaderToneMap, shaderProgramToneMap;
+
+	// density rendering
+	unsigned int densityFBO, densityTex; // gpu backend renders into densityTex
+	unsigned int densityWidth, densityHeight;
+	unsigned int densityFrames; // accumulated, 0: cleared before the next
+	unsigned int *densityCounts; // cpu backend, uploaded to densityTex
+
+	// the view, uploaded to viewUBO once per frame if it changed
+	viewBlock view;
+	unsigned int viewUBO;
+	unsigned int viewDirty;
 	// attractor parameters
 	unsigned int XLocation;
 	unsigned int YLocation;
 	unsigned int ZLocation;
-	// for integration
-	unsigned int stepSizeLocation;
-	unsigned int updatesPerFrameLocation;
-	// for cube
-	unsigned int cameraMatrixCubeLocation;
-	unsigned int perspectiveMatrixCubeLocation;
+	unsigned int degreeLocation;
+	// for integration, one program per flow
+	integrateProgram integrateCache[INTEGRATECACHESIZE];
+	// compute shaders integrate in place, so step2VBO stays empty and pos2VBO only holds the
+	// copy respawns read, if any. A dispatch covers at most maxComputeParticles, the storage
+	// block size limit.
+	unsigned int compute;
+	unsigned int workgroupSize;
+	size_t maxComputeParticles;
+	unsigned int nIntegrateCache;
+	unsigned long long integrateUses;
+	float tolerance;
+	// respawning escaped particles: the input is read through positionTexture, and with
+	// atomic counters in vertex shaders respawnCounter counts them, read back asynchronously
+	unsigned int positionTexture;
+	int maxPositions;
+	// compute shaders update the input in place, so respawns read a copy of it in pos2VBO
+	unsigned int respawnCopy;
+	unsigned int respawnStream; // integration passes so far
+	unsigned int respawnCounter; // 0: not supported
+	readbackRing respawnRing;
+	unsigned int respawned; // latest total read back
+	frameProfiler *profiler; // interactive, NULL otherwise
+	// trails: a ring of trailLength slots, each the positions of the trailParticles particles
+	// 0, trailStride, 2*trailStride, ... at one frame. trailHead is the newest slot.
+	unsigned int shaderProgramTrail;
+	unsigned int trailStrideLocation;
+	unsigned int trailVBO, trailTexture;
+	unsigned int trailLength; // 0: no trails
+	size_t trailMemory; // bytes the ring may take
+	size_t trailParticles;
+	unsigned int trailStride;
+	unsigned int trailHead;
+	unsigned int trailFilled; // slots written since the trails were cleared
+	unsigned int trailLengthLocation;
+	unsigned int trailHeadLocation;
+	unsigned int trailParticlesLocation;
+	unsigned int trailStrideDrawLocation;
+	// culling: every lodStride-th particle goes through the cull program, which captures the
+	// position and index of those in view into cullVBO. They are drawn with the count kept in
+	// cullTFO, which never comes back to the host. cullInputVAO is pointed at the particles
+	// with the stride of each frame, cullVAO at the captured points.
+	unsigned int cull;
+	unsigned int shaderProgramCull; // 0: not supported
+	unsigned int cullVBO, cullTFO;
+	unsigned int cullInputVAO, cullVAO;
+	float footprint; // pixels the cube covers
+	unsigned int lodStride; // of the latest frame
+	unsigned int culledLocation;
+	unsigned int lodStrideLocation;
+	unsigned int cullGroupSizeLocation;
+	unsigned int cullLodStrideLocation;
+	// for random initial positions
+	unsigned int seedLocation;
+	unsigned int streamLocation;
+	unsigned int volSizeLocation;
+	// for density rendering
+	unsigned int densityLocation;
+	// ensembles: per group coefficients and placement, see GROUPFLOATS
+	unsigned int nGroups; // 0: one flow for all particles
+	unsigned int groupColumns;
+	attractorParameters groupPattern; // non-zero where any group's coefficient is
+	unsigned int groupTBO, groupTexture;
+	unsigned int groupSizeLocation;
+	unsigned int inverseReferenceLocation;
+	unsigned int inverseLogPeakLocation;
 
 	// texture for font
 	unsigned int fontTex;
@@ -177,49 +761,269 @@ typedef struct {
 	float xTexCoord;
 } glyphInfo;
 
-// Struct for variables used in glfw callback
+// Struct for variables used in glfw callbacks. Keys held down act in every frame; presses
+// are queued, and each acts once in the next frame.
 typedef struct {
 	float pitch; // radians
 	float yaw; //radians
 	double prevX;
 	double prevY;
 	unsigned int updateTransformationUniformsRequired;
+	unsigned char held[GLFW_KEY_LAST+1];
+	int pressed[MAXKEYPRESSES];
+	unsigned int nPressed;
 } callbackVariables;
 
-
-int setupOpenGL(openglObjects *oglo, callbackVariables *cbVars, const unsigned int xres, const unsigned int yres);
+// Struct for command line options
+typedef struct {
+	unsigned int backend;
+	size_t nParticles;
+	unsigned int nThreads; // cpu backend, 0: all cpus
+	const char *cpuIsa; // cpu backend, NULL: widest supported
+	unsigned int integrator;
+	float tolerance; // rk45
+	unsigned int storage; // cpu backend render copy and uploads
+	unsigned int render;
+	unsigned int accumulate; // density: sum frames while the view and flow do not change
+	unsigned int seed; // initial positions
+	unsigned int respawn; // gpu backend: move escaped particles back onto the attractor
+	unsigned int compute; // gpu backend: integrate with compute shaders where OpenGL 4.3 has them
+	unsigned int workgroupSize; // compute, 0: the fastest in a short trial
+	unsigned int attractor;
+	const char *attractorFile; // definitions to use instead of the built-ins, NULL: none
+	unsigned int ensemble; // integrate every attractor of the library at once, side by side
+	float stepSize; // 0 on the command line: the attractor's
+	float volSize; // random initial positions in [-volSize,volSize]^3, from the attractor
+	int updatesPerFrame;
+	unsigned int xres;
+	unsigned int yres;
+	double simRate; // interactive: simulated time per second of wall time, 0: from REFERENCEFPS
+	unsigned int vsync;
+	unsigned int profile; // interactive: show the profiler from the start and log to profile.csv
+	unsigned int trailLength; // past positions per trail, 0: no trails at the start
+	size_t trailMemory; // bytes
+	unsigned int cull; // points: draw only those in view, fewer when they are dense on screen
+
+	// headless batch mode
+	unsigned int headless;
+	unsigned int nFrames;
+	unsigned int frameInterval; // write an image every frameInterval frames, 0: never
+	const char *outputDir;
+	unsigned int trajectoryInterval; // stream positions every trajectoryInterval frames, 0: never
+	unsigned int checkpointInterval; // snapshot every checkpointInterval frames, 0: never
+	const char *restoreFile; // start from this snapshot, NULL: random positions
+	const char *recordPipe; // encoder command reading raw rgb24 frames, NULL: PPM images
+	unsigned int recordWidth; // interactive recording resolution, 0: window resolution
+	unsigned int recordHeight;
+
+	// benchmark sweep
+	unsigned int benchmark;
+	unsigned int nBenchParticles;
+	size_t benchParticles[MAXBENCHVALUES];
+	unsigned int nBenchUpdates;
+	int benchUpdates[MAXBENCHVALUES];
+	unsigned int nBenchBackends;
+	unsigned int benchBackends[MAXBENCHVALUES];
+	unsigned int benchFrames; // maximum timed frames per configuration
+	double benchTime; // seconds per configuration, after which timing stops
+
+	// accuracy against the reference integrator, and cost, of the benchmark backends
+	unsigned int validate;
+	unsigned int nValidateSteps; // 0: around the attractor's step size
+	double validateSteps[MAXBENCHVALUES];
+	size_t validateParticles;
+	double validateTime; // simulated
+	unsigned int referencePrecision;
+
+	// Lyapunov exponent map over coefficient values, on the cpu
+	sweepSettings sweep;
+} runOptions;
+
+// Positions streamed to <outputDir>/trajectory.bin. The gpu backend reads them back
+// asynchronously; the cpu backend already holds the state on the host.
+typedef struct {
+	FILE *fp;
+	unsigned int backend;
+	readbackRing ring; // gpu backend
+	float *host; // cpu backend staging
+	size_t hostParticles;
+	unsigned long long records;
+	unsigned int writeError;
+} trajectoryStream;
+
+// Frames written every frameInterval frames. Pixels are read back asynchronously and handed
+// to a writer thread, so neither the readback nor the disk or encoder stall the render loop.
+// Interactively the scene is drawn at the recording resolution into fbo, then shown scaled
+// to the window; headless frames are read from frameFBO.
+typedef struct {
+	unsigned int width;
+	unsigned int height;
+	unsigned int fbo, texture; // interactive only, 0 otherwise
+	readbackRing ring;
+	frameWriter writer;
+	unsigned int error;
+} frameRecorder;
+
+// Accumulated phase times of one benchmark configuration, ms
+typedef struct {
+	double integrate;
+	double transformFeedback;
+	double upload;
+	double draw;
+	double swap;
+	double frame;
+	unsigned int frames;
+	unsigned int gpuFrames;
+} benchmarkTimes;
+
+
+int parseCommandLine(int argc, char **argv, runOptions *opts);
+unsigned int parseList(const char *list, double *values, unsigned int maxValues);
+int setupWindow(openglObjects *oglo, callbackVariables *cbVars, const unsigned int xres, const unsigned int yres, unsigned int vsync);
+int setupHeadlessContext(openglObjects *oglo, const unsigned int xres, const unsigned int yres);
+int setupOpenGL(openglObjects *oglo, const runOptions *opts);
+void cleanupOpenGL(openglObjects *oglo);
+int runHeadless(openglObjects *oglo, runOptions *opts, cpuIntegrator *cpu, const attractorParameters *params, unsigned long long firstStep);
+int runHeadlessCpu(runOptions *opts, const attractorLibrary *library, const attractorDefinition *attractor, snapshotMapping *restore);
+int runSweep(runOptions *opts, const attractorDefinition *attractor);
+int writePositions(const char *outputDir, const float *pos, size_t nParticles);
+int recorderOpen(frameRecorder *fr, const runOptions *opts, unsigned int width, unsigned int height, unsigned int offscreen);
+int recorderCapture(frameRecorder *fr, unsigned int number);
+void recorderPoll(frameRecorder *fr);
+void recorderShow(openglObjects *oglo, frameRecorder *fr);
+int recorderClose(frameRecorder *fr);
+int trajectoryOpen(trajectoryStream *ts, const char *outputDir, unsigned int backend, size_t nParticles);
+void trajectorySnapshot(trajectoryStream *ts, openglObjects *oglo, cpuIntegrator *cpu, unsigned long long step);
+void trajectoryPoll(trajectoryStream *ts);
+void trajectoryClose(trajectoryStream *ts);
+int writeCheckpoint(openglObjects *oglo, const runOptions *opts, cpuIntegrator *cpu, const attractorParameters *params, unsigned long long steps);
+void restoreParticles(openglObjects *oglo, unsigned int backend, cpuIntegrator *cpu, const snapshotMapping *sm);
+int runBenchmark(openglObjects *oglo, runOptions *opts, const attractorParameters *params);
+int runValidation(openglObjects *oglo, runOptions *opts, const attractorParameters *params);
+int validateSample(openglObjects *oglo, runOptions *opts, const attractorParameters *params, unsigned int backend,
+	cpuIntegrator *sample, const float *start, unsigned long long nSteps, float *result);
+double validateCost(openglObjects *oglo, runOptions *opts, gpuTimer *gt, const attractorParameters *params, unsigned int backend, cpuIntegrator *cpu);
+void benchmarkConfiguration(openglObjects *oglo, runOptions *opts, gpuTimer *gt, unsigned int backend, cpuIntegrator *cpu, size_t nParticles, int updatesPerFrame, const attractorParameters *params, benchmarkTimes *times);
+void benchmarkFrame(openglObjects *oglo, runOptions *opts, gpuTimer *gt, unsigned int backend, cpuIntegrator *cpu, size_t nParticles, int updatesPerFrame, const attractorParameters *params, benchmarkTimes *times);
+int allocateParticleBuffers(openglObjects *oglo, size_t nParticles);
+void pointParticleArrays(openglObjects *oglo);
+void bindParticleBuffers(openglObjects *oglo, unsigned int capture);
+void uploadView(openglObjects *oglo);
+void setParticleFormat(openglObjects *oglo, unsigned int backend, unsigned int storage);
+void randomizeParticles(openglObjects *oglo, unsigned int backend, cpuIntegrator *cpu, size_t first, float volSize, unsigned int seed, unsigned int stream);
+void uploadCpuPositions(openglObjects *oglo, cpuIntegrator *cpu);
+void swapParticleBuffers(openglObjects *oglo);
+int resizeParticles(openglObjects *oglo, runOptions *opts, cpuIntegrator *cpu, size_t nParticles, unsigned int stream);
+void drawCube(openglObjects *oglo);
+void advanceParticles(openglObjects *oglo, runOptions *opts, cpuIntegrator *cpu, const attractorParameters *params, unsigned int nSteps);
+void useRenderProgram(openglObjects *oglo);
+void drawParticles(openglObjects *oglo);
+int setTrails(openglObjects *oglo, unsigned int length, size_t memory);
+void recordTrails(openglObjects *oglo);
+void drawTrails(openglObjects *oglo);
+int setCulling(openglObjects *oglo, unsigned int cull);
+void drawCulled(openglObjects *oglo);
+int densityInit(openglObjects *oglo, unsigned int backend, unsigned int width, unsigned int height);
+void densityFree(openglObjects *oglo);
+void drawDensity(openglObjects *oglo, const runOptions *opts, cpuIntegrator *cpu);
+void drawFrame(openglObjects *oglo, const runOptions *opts, cpuIntegrator *cpu);
 void updateGLData(unsigned int *dstVBO, float *src, unsigned int size);
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
 void mousePointerCallback(GLFWwindow* window, double xpos, double ypos);
-void initializeParticlePositions(float* pos, const float volSize);
-void setAttractorParameters(openglObjects *oglo, unsigned int attractor);
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void setAttractorParameters(openglObjects *oglo, const attractorParameters *params);
+void specializeVelocitySource(const attractorParameters *params, unsigned int ensemble, char *source, size_t size);
+const integrateProgram *useIntegrateProgram(openglObjects *oglo, const attractorParameters *params);
+void setIntegrateUniforms(openglObjects *oglo, const integrateProgram *ip, const runOptions *opts, size_t nParticles, int nSteps);
+void respawnPoll(openglObjects *oglo, unsigned int wait);
+void integrateParticles(openglObjects *oglo, const runOptions *opts, const attractorParameters *params, size_t nParticles, int nSteps);
+void dispatchIntegration(openglObjects *oglo, const integrateProgram *ip, unsigned int positions, unsigned int steps, size_t nParticles);
+size_t respawnSources(const openglObjects *oglo, size_t nParticles);
+void trialWorkgroupSize(openglObjects *oglo, const runOptions *opts, const attractorParameters *params);
+void selectAttractor(openglObjects *oglo, runOptions *opts, const attractorDefinition *def, attractorParameters *params, float userStepSize);
+int setEnsemble(openglObjects *oglo, unsigned int backend, cpuIntegrator *cpu, const attractorLibrary *library, const attractorDefinition *reference);
+int ensembleGroupSize(const openglObjects *oglo);
 void prepareCubeVertices(openglObjects *oglo);
 void updateTransformationUniforms(openglObjects *oglo, callbackVariables *cbVars, float theta, float phi, unsigned int xres, unsigned int yres, glm::vec3 cameraPosition);
 void ftLoadGlyphs(openglObjects *oglo, FT_Face ftFace, glyphInfo *glyphs);
-void renderText(openglObjects *oglo, glyphInfo *glyphs, std::string text, float posx, float posy, int xres, int yres);
+void setText(openglObjects *oglo, const glyphInfo *glyphs, unsigned int line, const char *text, float posx, float posy, int xres, int yres);
+void drawText(openglObjects *oglo);
+unsigned int formatProfile(const frameProfiler *profiler, char strings[][MAXTEXTLENGTH]);
 
 
 
-int main(void)
+int main(int argc, char **argv)
 {
 	printf("attractors\n");
 
-	printf("Controls:\n"
+	runOptions opts;
+	if(parseCommandLine(argc, argv, &opts)) {
+		return EXIT_FAILURE;
+	}
+
+	// attractor definitions: built in, or from a file which is reloaded when it changes
+	attractorLibrary library;
+	if(opts.attractorFile == NULL) {
+		attractorLibraryBuiltin(&library);
+	}
+	else if(attractorLibraryLoad(&library, opts.attractorFile)) {
+		return EXIT_FAILURE;
+	}
+	unsigned int currentAttractor = opts.attractor;
+	const attractorDefinition *attractor = getAttractor(&library, currentAttractor);
+	if(attractor == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	// a restored run continues with the particles, flow and integration settings of the snapshot
+	snapshotMapping restore;
+	if(opts.restoreFile != NULL) {
+		if(snapshotMap(&restore, opts.restoreFile)) {
+			return EXIT_FAILURE;
+		}
+		opts.nParticles = restore.header.nParticles;
+		opts.integrator = restore.header.integrator;
+		opts.stepSize = restore.header.stepSize;
+		opts.tolerance = restore.header.tolerance;
+		printf("Restoring %zu particles at step %llu from %s\n", opts.nParticles,
+			(unsigned long long)restore.header.steps, opts.restoreFile);
+	}
+	// a step size given on the command line or restored stays when the attractor changes
+	const float userStepSize = opts.stepSize;
+	if(opts.stepSize == 0.0f) opts.stepSize = (attractor->stepSize > 0.0f) ? attractor->stepSize : DEFAULTSTEPSIZE;
+	opts.volSize = attractor->volSize;
+
+	// no OpenGL at all: integrate on the cpu and write the results
+	if(opts.sweep.nAxes > 0) {
+		return runSweep(&opts, attractor);
+	}
+	if(opts.headless && !opts.benchmark && opts.backend == BACKEND_CPU) {
+		return runHeadlessCpu(&opts, &library, attractor, (opts.restoreFile != NULL) ? &restore : NULL);
+	}
+
+	if(!opts.headless && !opts.benchmark) printf("Controls:\n"
 		"   w,a,s,d - move camera\n"
 		"   mouse --- aim camera\n"
 		"   r ------- reset particle positions\n"
 		"   t ------- reset particle positions, small initial volume\n"
 		"   p,o ----- pause,resume evolution\n"
 		"   l ------- manually advance evolution\n"
+		"   k ------- write a checkpoint\n"
 		"   z,x ----- scale attractor smaller,larger\n"
 		"   arrows -- rotate attractor\n"
-		"   1 ------- Lorenz attractor\n"
-		"   2 ------- Roessler attractor\n"
-		"   3 ------- Lu Chen attractor\n"
+		"   1-9 ----- attractor (built in: Lorenz, Roessler, Lu Chen)\n"
+		"   -,= ----- halve,double number of particles\n"
+		"   [,] ----- halve,double simulation rate\n"
+		"   g ------- show,hide frame phase times\n"
+		"   v ------- show,hide particle trails\n"
+		"   c ------- cull particles out of view or too dense to see, on,off\n"
 	);
 
-	const int xres = 1920;
-	const int yres = 1200;
+	const int xres = opts.xres;
+	const int yres = opts.yres;
+	// the projection matches the recorded frames, which are letterboxed in the window
+	const unsigned int recordWidth = (opts.frameInterval && opts.recordWidth) ? opts.recordWidth : xres;
+	const unsigned int recordHeight = (opts.frameInterval && opts.recordWidth) ? opts.recordHeight : yres;
 	openglObjects oglo;
 
 	callbackVariables cbVars;
@@ -228,51 +1032,102 @@ int main(void)
 	cbVars.prevX = xres/2.0f;
 	cbVars.prevY = yres/2.0f;
 	cbVars.updateTransformationUniformsRequired = 0;
+	memset(cbVars.held, 0, sizeof(cbVars.held));
+	cbVars.nPressed = 0;
 
-	if (setupOpenGL(&oglo, &cbVars, xres, yres)) {
-		printf("Error in setupOpenGL.\n");
+	if(opts.headless) {
+		if(setupHeadlessContext(&oglo, xres, yres)) {
+			printf("Error in setupHeadlessContext.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	else if(setupWindow(&oglo, &cbVars, xres, yres, opts.vsync)) {
+		printf("Error in setupWindow.\n");
 		return EXIT_FAILURE;
 	}
-
-
-	// Freetype
-	FT_Library ftLib;
-	if(FT_Init_FreeType(&ftLib)) {
-		fprintf(stderr, "Error initializing FreeType library\n");
+	if (setupOpenGL(&oglo, &opts)) {
+		printf("Error in setupOpenGL.\n");
 		return EXIT_FAILURE;
 	}
-	FT_Face ftFace;
-	if(FT_New_Face(ftLib, "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf", 0, &ftFace)) {
-		fprintf(stderr, "Error opeing font\n");
+	if(opts.render == RENDER_DENSITY && densityInit(&oglo, opts.backend, recordWidth, recordHeight)) {
 		return EXIT_FAILURE;
 	}
-	FT_Set_Pixel_Sizes(ftFace, 0,60);
-	glyphInfo glyphs[128];
-	ftLoadGlyphs(&oglo, ftFace, glyphs);
-	FT_Done_Face(ftFace);
-	FT_Done_FreeType(ftLib);
 
 
-	// allocate and initialise point position array
-	float *pos = (float*)malloc(NPARTICLES * 3 * sizeof(float));
-	initializeParticlePositions(pos, 40.0f);
-	glUseProgram(oglo.shaderProgram);
-	updateGLData(&(oglo.pos1VBO), pos, 3*NPARTICLES);
+	// Freetype, only the interactive mode draws text
+	glyphInfo glyphs[128];
+	if(!opts.headless) {
+		FT_Library ftLib;
+		if(FT_Init_FreeType(&ftLib)) {
+			fprintf(stderr, "Error initializing FreeType library\n");
+			return EXIT_FAILURE;
+		}
+		FT_Face ftFace;
+		if(FT_New_Face(ftLib, "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf", 0, &ftFace)) {
+			fprintf(stderr, "Error opeing font\n");
+			return EXIT_FAILURE;
+		}
+		FT_Set_Pixel_Sizes(ftFace, 0,60);
+		ftLoadGlyphs(&oglo, ftFace, glyphs);
+		FT_Done_Face(ftFace);
+		FT_Done_FreeType(ftLib);
+	}
+
 
+	// the cpu backend keeps its own SoA copy of the positions
+	cpuIntegrator cpu;
+	if(opts.backend == BACKEND_CPU) {
+		if(cpuIntegratorInit(&cpu, opts.nParticles, opts.nThreads, opts.cpuIsa)) {
+			return EXIT_FAILURE;
+		}
+	}
+	// initial positions are random stream 0 of the seed, each reset takes the next stream
+	unsigned int resets = 0;
+	unsigned long long firstStep = 0;
+	if(opts.restoreFile != NULL) {
+		restoreParticles(&oglo, opts.backend, &cpu, &restore);
+		firstStep = restore.header.steps;
+	}
+	else {
+		randomizeParticles(&oglo, opts.backend, &cpu, 0, opts.volSize, opts.seed, resets);
+	}
 
-	// shader uniforms
-	// to bring attractor within viewable volume
-	float scaleFactor = 40.0f;
-	glUniform1f(oglo.scaleFactorLocation, scaleFactor);
 
-	// choose default attractor
-	setAttractorParameters(&oglo, 1);
+	// flow and view of the attractor; its scale factor brings it within the viewable volume.
+	// A restored run keeps the flow of the snapshot.
+	attractorParameters params;
+	selectAttractor(&oglo, &opts, attractor, &params, userStepSize);
+	if(opts.restoreFile != NULL) {
+		memcpy(params.X, restore.header.X, sizeof(params.X));
+		memcpy(params.Y, restore.header.Y, sizeof(params.Y));
+		memcpy(params.Z, restore.header.Z, sizeof(params.Z));
+		attractorSetDegree(&params);
+		setAttractorParameters(&oglo, &params);
+		snapshotUnmap(&restore);
+	}
+	if(opts.ensemble && !opts.benchmark && setEnsemble(&oglo, opts.backend, &cpu, &library, attractor)) {
+		return EXIT_FAILURE;
+	}
+	if(oglo.compute && opts.workgroupSize == 0 && (opts.backend == BACKEND_GPU || opts.benchmark)) {
+		trialWorkgroupSize(&oglo, &opts, &params);
+	}
+	// trails are lines among the points, so not part of density images
+	const unsigned int trailLength = opts.trailLength ? opts.trailLength : DEFAULTTRAILLENGTH;
+	if(opts.render == RENDER_DENSITY && opts.trailLength) {
+		printf("Trails are only drawn with --render points\n");
+	}
+	else if(opts.trailLength && !opts.benchmark && setTrails(&oglo, opts.trailLength, opts.trailMemory)) {
+		return EXIT_FAILURE;
+	}
+	// density counts every particle, so there is nothing to cull
+	if(opts.cull && opts.render == RENDER_POINTS && !opts.benchmark) setCulling(&oglo, 1);
 
-	// for integration
-	float stepSize = 0.001f;
-	glUniform1f(oglo.stepSizeLocation, stepSize);
-	int updatesPerFrame = 10;
-	glUniform1i(oglo.updatesPerFrameLocation, updatesPerFrame);
+	// for integration. The simulation advances at simRate time units per second, in
+	// steps of opts.stepSize, however fast frames are drawn
+	const int updatesPerFrame = opts.updatesPerFrame;
+	double simRate = (opts.simRate > 0.0) ? opts.simRate : REFERENCEFPS * opts.stepSize * updatesPerFrame;
+	double simTimeDue = 0.0;
+	unsigned int paused = 0;
 
 	// for cube
 	prepareCubeVertices(&oglo);
@@ -282,281 +1137,2433 @@ int main(void)
 	float phi = 0.0f; //radians
 	glm::vec3 cameraPosition = glm::vec3(0.0f,0.0f,-2.0f);
 	//glm::vec3 cameraDirection = glm::vec3(0.0f, 0.0f, 1.0f);
-	updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+	updateTransformationUniforms(&oglo, &cbVars, theta, phi, recordWidth, recordHeight, cameraPosition);
+
+
+	// batch modes: fixed number of frames, no input
+	if(opts.benchmark || opts.headless) {
+		int status;
+		if(opts.validate) status = runValidation(&oglo, &opts, &params);
+		else if(opts.benchmark) status = runBenchmark(&oglo, &opts, &params);
+		else status = runHeadless(&oglo, &opts, &cpu, &params, firstStep);
+		if(opts.backend == BACKEND_CPU) cpuIntegratorFree(&cpu);
+		cleanupOpenGL(&oglo);
+		return status;
+	}
 
-	// translation to move points relative to cube -- try to centre the attractors
-	glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -0.5f));
-	glUniformMatrix4fv(oglo.translationMatrixLocation, 1, GL_FALSE, glm::value_ptr(translationMatrix));
 
+	trajectoryStream trajectory;
+	trajectory.fp = NULL;
+	if(opts.trajectoryInterval && trajectoryOpen(&trajectory, opts.outputDir, opts.backend, oglo.nParticles)) {
+		return EXIT_FAILURE;
+	}
+	frameRecorder recorder;
+	unsigned int recording = (opts.frameInterval != 0);
+	if(recording && recorderOpen(&recorder, &opts, recordWidth, recordHeight, 1)) {
+		return EXIT_FAILURE;
+	}
+
+	// phase times of every frame, shown with g
+	frameProfiler profiler;
+	char profileFile[MAXPATHLENGTH];
+	snprintf(profileFile, MAXPATHLENGTH, "%s/profile.csv", opts.outputDir);
+	if(frameProfilerInit(&profiler, PROFILENPHASES, profilePhaseNames, profilePhaseGpu, opts.profile ? profileFile : NULL)) {
+		return EXIT_FAILURE;
+	}
+	oglo.profiler = &profiler;
+	unsigned int showProfile = opts.profile;
+	char profileStrings[PROFILENPHASES+2][MAXTEXTLENGTH];
+	unsigned int nProfileStrings = 0;
 
 	// Start event loop
 	double startTime = GetWallTime();
 	double fpsUpdate = 0;
-	char fpsString[MAXTEXTLENGTH];
+	char fpsString[MAXTEXTLENGTH] = "";
+	char attractorString[MAXTEXTLENGTH];
 	unsigned int totalFrames = 0;
 	unsigned int fpsUpdateFrames = 0;
-	unsigned int updateAttractorOnce = 0;
+	unsigned int advanceOnce = 0;
+	unsigned long long totalSteps = firstStep;
+	double lastFrameTime = startTime;
+	double lastReload = startTime;
+	double particleSteps = 0.0;
+	double totalParticleSteps = 0.0;
+	double stepRate = 0.0;
 
 	while(!glfwWindowShouldClose(oglo.window)) {
 
-		// User control
-		if(glfwGetKey(oglo.window, GLFW_KEY_Z) == GLFW_PRESS) {
-			scaleFactor *= 1.1f;
-			glUseProgram(oglo.shaderProgram);
-			glUniform1f(oglo.scaleFactorLocation, scaleFactor);
-		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_X) == GLFW_PRESS) {
-			scaleFactor /= 1.1f;
-			glUseProgram(oglo.shaderProgram);
-			glUniform1f(oglo.scaleFactorLocation, scaleFactor);
-		}
-
-		if(glfwGetKey(oglo.window, GLFW_KEY_R) == GLFW_PRESS) {
-			initializeParticlePositions(pos, 40.0f);
-			updateGLData(&(oglo.pos1VBO), pos, 3*NPARTICLES);
-		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_T) == GLFW_PRESS) {
-			initializeParticlePositions(pos, 0.5f);
-			updateGLData(&(oglo.pos1VBO), pos, 3*NPARTICLES);
+		// User control. The callbacks record key events as they arrive; each press acts once,
+		// held keys act in every frame.
+		frameProfilerBegin(&profiler, PROFILEINPUT);
+		for(unsigned int k = 0; k < cbVars.nPressed; k++) {
+			const int key = cbVars.pressed[k];
+			switch(key) {
+				case GLFW_KEY_R:
+					randomizeParticles(&oglo, opts.backend, &cpu, 0, opts.volSize, opts.seed, ++resets);
+					break;
+				case GLFW_KEY_T:
+					randomizeParticles(&oglo, opts.backend, &cpu, 0, 0.5f, opts.seed, ++resets);
+					break;
+				case GLFW_KEY_EQUAL:
+					resizeParticles(&oglo, &opts, &cpu, 2*oglo.nParticles, resets);
+					break;
+				case GLFW_KEY_MINUS:
+					if(oglo.nParticles/2 >= MINNPARTICLES) resizeParticles(&oglo, &opts, &cpu, oglo.nParticles/2, resets);
+					break;
+				case GLFW_KEY_K:
+					writeCheckpoint(&oglo, &opts, &cpu, &params, totalSteps);
+					break;
+				case GLFW_KEY_RIGHT_BRACKET:
+					simRate *= 2.0;
+					break;
+				case GLFW_KEY_LEFT_BRACKET:
+					simRate /= 2.0;
+					break;
+				case GLFW_KEY_G:
+					showProfile = !showProfile;
+					break;
+				case GLFW_KEY_V:
+					if(opts.render != RENDER_DENSITY) setTrails(&oglo, oglo.trailLength ? 0 : trailLength, opts.trailMemory);
+					break;
+				case GLFW_KEY_C:
+					if(opts.render != RENDER_DENSITY) setCulling(&oglo, !oglo.cull);
+					break;
+				case GLFW_KEY_P:
+					paused = 1;
+					break;
+				case GLFW_KEY_O:
+					paused = 0;
+					break;
+				case GLFW_KEY_ESCAPE:
+					glfwSetWindowShouldClose(oglo.window, 1);
+					break;
+				default:
+					if(key > GLFW_KEY_0 && key <= GLFW_KEY_9 && (unsigned int)(key - GLFW_KEY_0) <= library.n && !opts.ensemble) {
+						currentAttractor = key - GLFW_KEY_0;
+						selectAttractor(&oglo, &opts, &(library.attractors[currentAttractor-1]), &params, userStepSize);
+						// keep the steps per frame, not the simulated time, when the step size changes
+						if(opts.simRate == 0.0) simRate = REFERENCEFPS * opts.stepSize * updatesPerFrame;
+					}
+					break;
+			}
 		}
+		cbVars.nPressed = 0;
 
-		if(glfwGetKey(oglo.window, GLFW_KEY_P) == GLFW_PRESS) {
-			glUseProgram(oglo.shaderProgram);
-			glUniform1f(oglo.stepSizeLocation, 0.0f);
+		if(cbVars.held[GLFW_KEY_Z]) {
+			oglo.densityFrames = 0;
+			oglo.view.scaleFactor *= 1.1f;
+			oglo.viewDirty = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_O) == GLFW_PRESS) {
-			glUseProgram(oglo.shaderProgram);
-			glUniform1f(oglo.stepSizeLocation, stepSize);
+		if(cbVars.held[GLFW_KEY_X]) {
+			oglo.densityFrames = 0;
+			oglo.view.scaleFactor /= 1.1f;
+			oglo.viewDirty = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_L) == GLFW_PRESS) {
-			glUseProgram(oglo.shaderProgram);
-			glUniform1f(oglo.stepSizeLocation, stepSize);
-			updateAttractorOnce = 1;
+		if(cbVars.held[GLFW_KEY_L]) {
+			paused = 1;
+			advanceOnce = 1;
 		}
 
-		if(glfwGetKey(oglo.window, GLFW_KEY_1) == GLFW_PRESS) {
-			setAttractorParameters(&oglo, 1);
-		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_2) == GLFW_PRESS) {
-			setAttractorParameters(&oglo, 2);
-		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_3) == GLFW_PRESS) {
-			setAttractorParameters(&oglo, 3);
+		// pick up edits of the definitions; a broken file is reported and the old one kept
+		if(opts.attractorFile != NULL && GetWallTime() - lastReload > RELOADINTERVAL) {
+			lastReload = GetWallTime();
+			if(attractorLibraryReload(&library, opts.attractorFile) == 1) {
+				if(currentAttractor > library.n) currentAttractor = 1;
+				printf("Reloaded %u attractors from %s\n", library.n, opts.attractorFile);
+				selectAttractor(&oglo, &opts, &(library.attractors[currentAttractor-1]), &params, userStepSize);
+				if(opts.ensemble) setEnsemble(&oglo, opts.backend, &cpu, &library, &(library.attractors[currentAttractor-1]));
+				if(opts.simRate == 0.0) simRate = REFERENCEFPS * opts.stepSize * updatesPerFrame;
+			}
 		}
 
-		if(glfwGetKey(oglo.window, GLFW_KEY_W) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_W]) {
 			cameraPosition += MOVEMENTDELTA * glm::vec3(cos(cbVars.pitch)*cos(cbVars.yaw), sin(cbVars.pitch), cos(cbVars.pitch)*sin(cbVars.yaw));
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_S) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_S]) {
 			cameraPosition -= MOVEMENTDELTA * glm::vec3(cos(cbVars.pitch)*cos(cbVars.yaw), sin(cbVars.pitch), cos(cbVars.pitch)*sin(cbVars.yaw));
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_A) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_A]) {
 			cameraPosition += MOVEMENTDELTA * glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(cos(cbVars.pitch)*cos(cbVars.yaw), sin(cbVars.pitch), cos(cbVars.pitch)*sin(cbVars.yaw)));
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_D) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_D]) {
 			cameraPosition -= MOVEMENTDELTA * glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(cos(cbVars.pitch)*cos(cbVars.yaw), sin(cbVars.pitch), cos(cbVars.pitch)*sin(cbVars.yaw)));
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
 
-		if(glfwGetKey(oglo.window, GLFW_KEY_UP) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_UP]) {
 			theta -= ROTATIONDELTA;
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_DOWN) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_DOWN]) {
 			theta += ROTATIONDELTA;
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_LEFT) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_LEFT]) {
 			phi += ROTATIONDELTA;
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
-		if(glfwGetKey(oglo.window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
+		if(cbVars.held[GLFW_KEY_RIGHT]) {
 			phi -= ROTATIONDELTA;
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			cbVars.updateTransformationUniformsRequired = 1;
 		}
 
-		if(glfwGetKey(oglo.window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
-			glfwSetWindowShouldClose(oglo.window, 1);
-		}
+		frameProfilerEnd(&profiler);
 
-		// this update is triggered by the cursor movement callback
+		// this update is triggered by the cursor movement callback and the camera keys
+		frameProfilerBegin(&profiler, PROFILEUNIFORMS);
 		if(cbVars.updateTransformationUniformsRequired) {
-			updateTransformationUniforms(&oglo, &cbVars, theta, phi, xres, yres, cameraPosition);
+			updateTransformationUniforms(&oglo, &cbVars, theta, phi, recordWidth, recordHeight, cameraPosition);
 			cbVars.updateTransformationUniformsRequired = 0;
 		}
+		uploadView(&oglo);
+		frameProfilerEnd(&profiler);
+
+		// whole steps of simulated time owed since the last frame. Manual advance is one
+		// frame's worth of steps at the reference rate.
+		double now = GetWallTime();
+		double frameTime = now - lastFrameTime;
+		lastFrameTime = now;
+		if(frameTime > MAXFRAMETIME) frameTime = MAXFRAMETIME;
+		unsigned int nSteps = 0;
+		if(advanceOnce) {
+			nSteps = updatesPerFrame;
+			advanceOnce = 0;
+		}
+		else if(!paused) {
+			simTimeDue += frameTime * simRate;
+			nSteps = (unsigned int)(simTimeDue / opts.stepSize);
+			simTimeDue -= nSteps * opts.stepSize;
+		}
+		if(nSteps > 0) {
+			frameProfilerBegin(&profiler, PROFILEINTEGRATE);
+			advanceParticles(&oglo, &opts, &cpu, &params, nSteps);
+			frameProfilerEnd(&profiler);
+			particleSteps += (double)oglo.nParticles * nSteps;
+			totalSteps += nSteps;
+		}
+		if(opts.trajectoryInterval) {
+			if(totalFrames % opts.trajectoryInterval == 0) {
+				trajectorySnapshot(&trajectory, &oglo, &cpu, totalSteps);
+			}
+			trajectoryPoll(&trajectory);
+		}
+		if(opts.checkpointInterval && totalFrames > 0 && totalFrames % opts.checkpointInterval == 0) {
+			writeCheckpoint(&oglo, &opts, &cpu, &params, totalSteps);
+		}
 
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		// draw cube
-		glUseProgram(oglo.shaderProgramCube);
-		glBindBuffer(GL_ARRAY_BUFFER, oglo.cubeVBO);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
-		glDrawArrays(GL_LINES, 0, 24);
-
-		// draw particles
-		glUseProgram(oglo.shaderProgram);
-		glBindBuffer(GL_ARRAY_BUFFER, oglo.pos1VBO);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
-		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, oglo.pos2VBO);
-		glBeginTransformFeedback(GL_POINTS);
-		glDrawArrays(GL_POINTS, 0, NPARTICLES);
-		glEndTransformFeedback();
-
-		// swap buffers 1 and 2: output becomes input
-		unsigned int tmp = oglo.pos1VBO;
-		oglo.pos1VBO = oglo.pos2VBO;
-		oglo.pos2VBO = tmp;
+		if(recording) {
+			glBindFramebuffer(GL_FRAMEBUFFER, recorder.fbo);
+			glViewport(0, 0, recorder.width, recorder.height);
+		}
+		drawFrame(&oglo, &opts, &cpu);
+
+		if(recording) {
+			int status = EXIT_SUCCESS;
+			if(totalFrames % opts.frameInterval == 0) status = recorderCapture(&recorder, totalFrames);
+			recorderPoll(&recorder);
+			recorderShow(&oglo, &recorder);
+			if(status || recorder.error) {
+				fprintf(stderr, "Error writing frames, recording stopped\n");
+				recorderClose(&recorder);
+				recording = 0;
+			}
+		}
 
-		// update fps counter every second
+		// update fps and particle-steps/second counters every second
+		frameProfilerBegin(&profiler, PROFILETEXT);
 		if(GetWallTime()-fpsUpdate > 1.0) {
 			fpsUpdateFrames = totalFrames-fpsUpdateFrames;
 			float fps = (float)fpsUpdateFrames/(GetWallTime()-fpsUpdate);
-			sprintf(fpsString, "FPS: %.1f", fps);
+			if(opts.backend == BACKEND_CPU) {
+				// integration time only, excluding upload and drawing
+				stepRate = cpuIntegratorThroughput(&cpu);
+			}
+			else {
+				stepRate = particleSteps/(GetWallTime()-fpsUpdate);
+			}
+			totalParticleSteps += particleSteps;
+			particleSteps = 0.0;
+			int n = sprintf(fpsString, "FPS: %.1f  Steps/s: %.3g  Particles: %zu  Sim rate: %.3g", fps, stepRate, oglo.nParticles, simRate);
+			if(opts.backend == BACKEND_GPU && opts.respawn && oglo.respawnCounter) sprintf(fpsString + n, "  Respawned: %u", oglo.respawned);
 			fpsUpdate = GetWallTime();
 			fpsUpdateFrames = totalFrames;
+			nProfileStrings = formatProfile(&profiler, profileStrings);
 		}
-		renderText(&oglo, glyphs, fpsString, -1.0f, -1.0f, xres, yres);
+		// only lines which changed are laid out and uploaded again
+		const float lineHeight = TEXTLINEHEIGHT * (float)xres/(float)yres;
+		int n = snprintf(attractorString, MAXTEXTLENGTH, "%s  %s  h = %g", opts.ensemble ? "ensemble" : library.attractors[currentAttractor-1].name,
+			integratorName(opts.integrator), opts.stepSize);
+		if(oglo.cull) snprintf(attractorString + n, MAXTEXTLENGTH - n, "  culled, 1 in %u drawn", oglo.lodStride);
+		setText(&oglo, glyphs, TEXTLINESTATUS, fpsString, -1.0f, -1.0f, xres, yres);
+		setText(&oglo, glyphs, TEXTLINEATTRACTOR, attractorString, -1.0f, -1.0f + lineHeight, xres, yres);
+		// down from the top left corner
+		for(unsigned int i = 0; i < PROFILENPHASES+2; i++) {
+			setText(&oglo, glyphs, TEXTLINEPROFILE+i, (showProfile && i < nProfileStrings) ? profileStrings[i] : "",
+				-1.0f, 1.0f - (i+1) * lineHeight, xres, yres);
+		}
+		drawText(&oglo);
+		frameProfilerEnd(&profiler);
 
+		frameProfilerBegin(&profiler, PROFILESWAP);
 		glfwSwapBuffers(oglo.window);
+		frameProfilerEnd(&profiler);
+		frameProfilerBegin(&profiler, PROFILEINPUT);
 		glfwPollEvents();
+		frameProfilerEnd(&profiler);
+		frameProfilerEndFrame(&profiler);
 		totalFrames++;
-
-		// if manually advancing, set stepSize to zero to halt evolution
-		if(updateAttractorOnce) {
-			glUseProgram(oglo.shaderProgram);
-			glUniform1f(oglo.stepSizeLocation, 0.0f);
-			updateAttractorOnce = 0;
-		}
 	}
+	totalParticleSteps += particleSteps;
 	printf("Average fps: %lf\n", totalFrames/(GetWallTime()-startTime));
+	printf("Average particle-steps/s (%s backend): %.4g\n", (opts.backend == BACKEND_CPU) ? "cpu" : "gpu",
+		totalParticleSteps/(GetWallTime()-startTime));
+	if(opts.profile) {
+		nProfileStrings = formatProfile(&profiler, profileStrings);
+		for(unsigned int i = 0; i < nProfileStrings; i++) printf("%s\n", profileStrings[i]);
+	}
+	oglo.profiler = NULL;
+	frameProfilerFree(&profiler);
 
 
 	// Clean up allocations
-	free(pos);
-	glDeleteVertexArrays(1, &(oglo.VAO));
-	glDeleteBuffers(1, &(oglo.pos1VBO));
-	glDeleteBuffers(1, &(oglo.pos2VBO));
-	glDeleteVertexArrays(1, &(oglo.cubeVAO));
-	glDeleteBuffers(1, &(oglo.cubeVBO));
-	glfwTerminate();
+	if(recording) recorderClose(&recorder);
+	if(opts.trajectoryInterval) trajectoryClose(&trajectory);
+	if(opts.backend == BACKEND_CPU) cpuIntegratorFree(&cpu);
+	cleanupOpenGL(&oglo);
 	return EXIT_SUCCESS;
 }
 
 
 
-int setupOpenGL(openglObjects *oglo, callbackVariables *cbVars, const unsigned int xres, const unsigned int yres)
+int runHeadless(openglObjects *oglo, runOptions *opts, cpuIntegrator *cpu, const attractorParameters *params, unsigned long long firstStep)
 {
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-#ifdef FOROSX
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-	glfwWindowHint(GLFW_SAMPLES, 4);
+	printf("Headless: %u frames of attractor %u, %s backend, %s integrator, output in %s\n", opts->nFrames, opts->attractor,
+		(opts->backend == BACKEND_CPU) ? "cpu" : "gpu", integratorName(opts->integrator), opts->outputDir);
+	trajectoryStream trajectory;
+	if(opts->trajectoryInterval && trajectoryOpen(&trajectory, opts->outputDir, opts->backend, oglo->nParticles)) {
+		return EXIT_FAILURE;
+	}
+	frameRecorder recorder;
+	if(opts->frameInterval && recorderOpen(&recorder, opts, opts->xres, opts->yres, 0)) {
+		if(opts->trajectoryInterval) trajectoryClose(&trajectory);
+		return EXIT_FAILURE;
+	}
 
-	//oglo->window = glfwCreateWindow(xres, yres, "attractors", NULL, NULL);
-	// For fullscreen:
-	oglo->window = glfwCreateWindow(xres, yres, "attractors", glfwGetPrimaryMonitor(), NULL);
-	if(oglo->window == NULL) {
-		fprintf(stderr, "Error in glfwCreateWindow\n");
-		glfwTerminate();
+	double startTime = GetWallTime();
+	for(unsigned int frame = 0; frame < opts->nFrames; frame++) {
+		advanceParticles(oglo, opts, cpu, params, opts->updatesPerFrame);
+		unsigned long long step = firstStep + (unsigned long long)(frame+1) * opts->updatesPerFrame;
+		if(opts->trajectoryInterval) {
+			if((frame+1) % opts->trajectoryInterval == 0) {
+				trajectorySnapshot(&trajectory, oglo, cpu, step);
+			}
+			trajectoryPoll(&trajectory);
+		}
+		if(opts->checkpointInterval && (frame+1) % opts->checkpointInterval == 0) {
+			writeCheckpoint(oglo, opts, cpu, params, step);
+		}
+		drawFrame(oglo, opts, cpu);
+
+		if(opts->frameInterval) {
+			if((frame+1) % opts->frameInterval == 0) recorderCapture(&recorder, frame+1);
+			recorderPoll(&recorder);
+			if(recorder.error) {
+				recorderClose(&recorder);
+				if(opts->trajectoryInterval) trajectoryClose(&trajectory);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if(opts->frameInterval && recorderClose(&recorder)) {
+		if(opts->trajectoryInterval) trajectoryClose(&trajectory);
 		return EXIT_FAILURE;
 	}
+	if(opts->trajectoryInterval) trajectoryClose(&trajectory);
+	glFinish();
+	double elapsed = GetWallTime() - startTime;
+	printf("Headless: %.3lf s, %.4g particle-steps/s\n", elapsed,
+		(double)oglo->nParticles * opts->updatesPerFrame * opts->nFrames / elapsed);
+	if(opts->backend == BACKEND_GPU && opts->respawn && oglo->respawnCounter) {
+		respawnPoll(oglo, 1);
+		printf("Respawned %u escaped particles\n", oglo->respawned);
+	}
 
-	glfwMakeContextCurrent(oglo->window);
-	glfwSetInputMode(oglo->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-	// set initial cursor position
-	glfwGetCursorPos(oglo->window, &(cbVars->prevX), &(cbVars->prevY));
+	// fetch the final state
+	float *pos = (float*)malloc(oglo->nParticles * 3 * sizeof(float));
+	if(pos == NULL) {
+		fprintf(stderr, "Error allocating %zu particles\n", oglo->nParticles);
+		return EXIT_FAILURE;
+	}
+	if(opts->backend == BACKEND_CPU) {
+		cpuIntegratorGetPositions(cpu, pos);
+	}
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, oglo->pos1VBO);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float)*3*oglo->nParticles, pos);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	int status = writePositions(opts->outputDir, pos, oglo->nParticles);
+	free(pos);
+	return status;
+}
 
-	// vsync? 0 disabled, 1 enabled
-	glfwSwapInterval(0);
-	glfwSetFramebufferSizeCallback(oglo->window, framebufferSizeCallback);
-	glfwSetCursorPosCallback(oglo->window, mousePointerCallback);
-	glfwSetWindowUserPointer(oglo->window, cbVars);
-	glViewport(0, 0, xres, yres);
 
-	if (glewInit() != GLEW_OK) {
-		fprintf(stderr, "Error, failed to initialize GLEW. Line: %d\n", __LINE__);
-		return -1;
+
+int runHeadlessCpu(runOptions *opts, const attractorLibrary *library, const attractorDefinition *attractor, snapshotMapping *restore)
+{
+	attractorParameters params = attractor->params;
+	if(restore != NULL) {
+		memcpy(params.X, restore->header.X, sizeof(params.X));
+		memcpy(params.Y, restore->header.Y, sizeof(params.Y));
+		memcpy(params.Z, restore->header.Z, sizeof(params.Z));
+		attractorSetDegree(&params);
 	}
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_PROGRAM_POINT_SIZE);
+	float *pos = (float*)malloc(opts->nParticles * 3 * sizeof(float));
+	if(pos == NULL) {
+		fprintf(stderr, "Error allocating %zu particles\n", opts->nParticles);
+		return EXIT_FAILURE;
+	}
+	cpuIntegrator cpu;
+	if(cpuIntegratorInit(&cpu, opts->nParticles, opts->nThreads, opts->cpuIsa)) {
+		free(pos);
+		return EXIT_FAILURE;
+	}
+	if(opts->ensemble) {
+		attractorParameters *groups = (attractorParameters*)malloc(library->n * sizeof(attractorParameters));
+		if(groups != NULL) {
+			for(unsigned int g = 0; g < library->n; g++) groups[g] = library->attractors[g].params;
+		}
+		if(groups == NULL || cpuIntegratorSetGroups(&cpu, groups, library->n)) {
+			free(groups);
+			free(pos);
+			cpuIntegratorFree(&cpu);
+			return EXIT_FAILURE;
+		}
+		free(groups);
+		printf("Ensemble: %u flows of %zu particles\n", library->n, cpuIntegratorGroupSize(opts->nParticles, library->n));
+	}
+	unsigned long long firstStep = 0;
+	if(restore != NULL) {
+		restoreParticles(NULL, BACKEND_CPU, &cpu, restore);
+		firstStep = restore->header.steps;
+		snapshotUnmap(restore);
+	}
+	else {
+		cpuIntegratorRandomPositions(&cpu, 0, opts->volSize, opts->seed, 0);
+	}
 
+	printf("Headless: %u frames of attractor %u, cpu backend without OpenGL, %s integrator, output in %s\n",
+		opts->nFrames, opts->attractor, integratorName(opts->integrator), opts->outputDir);
+	if(opts->frameInterval) {
+		printf("Warning: no OpenGL context, frame images are not written\n");
+	}
 
-	// shaders and buffers for particles
-	oglo->vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(oglo->vertexShader, 1, &vertexShaderSource, NULL);
-	glCompileShader(oglo->vertexShader);
-	int success;
-	char compileLog[OGLLOGSIZE];
-	glGetShaderiv(oglo->vertexShader, GL_COMPILE_STATUS, &success);
-	if(!success) {
-		glGetShaderInfoLog(oglo->vertexShader, OGLLOGSIZE, NULL, compileLog);
-		fprintf(stderr, "Error in particles vertex shader compilation:\n%s\n", compileLog);
+	trajectoryStream trajectory;
+	if(opts->trajectoryInterval && trajectoryOpen(&trajectory, opts->outputDir, BACKEND_CPU, opts->nParticles)) {
+		cpuIntegratorFree(&cpu);
+		free(pos);
+		return EXIT_FAILURE;
+	}
+
+	double startTime = GetWallTime();
+	for(unsigned int frame = 0; frame < opts->nFrames; frame++) {
+		cpuIntegratorStep(&cpu, &params, opts->integrator, opts->stepSize, opts->updatesPerFrame, opts->tolerance);
+		unsigned long long step = firstStep + (unsigned long long)(frame+1) * opts->updatesPerFrame;
+		if(opts->trajectoryInterval && (frame+1) % opts->trajectoryInterval == 0) {
+			trajectorySnapshot(&trajectory, NULL, &cpu, step);
+		}
+		if(opts->checkpointInterval && (frame+1) % opts->checkpointInterval == 0) {
+			writeCheckpoint(NULL, opts, &cpu, &params, step);
+		}
+	}
+	if(opts->trajectoryInterval) trajectoryClose(&trajectory);
+	double elapsed = GetWallTime() - startTime;
+	printf("Headless: %.3lf s, %.4g particle-steps/s\n", elapsed,
+		(double)opts->nParticles * opts->updatesPerFrame * opts->nFrames / elapsed);
+
+	cpuIntegratorGetPositions(&cpu, pos);
+	int status = writePositions(opts->outputDir, pos, opts->nParticles);
+	cpuIntegratorFree(&cpu);
+	free(pos);
+	return status;
+}
+
+
+
+// The sweep varies the coefficients of the selected attractor and starts from its volume
+int runSweep(runOptions *opts, const attractorDefinition *attractor)
+{
+	size_t nPoints = sweepPoints(&(opts->sweep));
+	sweepPoint *points = (sweepPoint*)malloc(nPoints * sizeof(sweepPoint));
+	if(points == NULL) {
+		fprintf(stderr, "Error allocating %zu sweep points\n", nPoints);
+		return EXIT_FAILURE;
+	}
+	cpuIntegrator cpu;
+	if(cpuIntegratorInit(&cpu, opts->sweep.cloudSize, opts->nThreads, opts->cpuIsa)) {
+		free(points);
+		return EXIT_FAILURE;
+	}
+	printf("Sweep of attractor %u (%s), step size %g\n", opts->attractor, attractor->name, opts->stepSize);
+	int status = sweepRun(&(opts->sweep), &cpu, &(attractor->params), opts->integrator, opts->stepSize,
+		opts->tolerance, opts->volSize, opts->seed, points);
+	if(status == EXIT_SUCCESS) status = sweepWrite(&(opts->sweep), points, opts->outputDir);
+	cpuIntegratorFree(&cpu);
+	free(points);
+	return status;
+}
+
+
+
+int writePositions(const char *outputDir, const float *pos, size_t nParticles)
+{
+	char filename[MAXPATHLENGTH];
+	snprintf(filename, MAXPATHLENGTH, "%s/positions.bin", outputDir);
+	FILE *fp = fopen(filename, "wb");
+	if(fp == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", filename);
+		return EXIT_FAILURE;
+	}
+	// raw interleaved xyz float32
+	size_t written = fwrite(pos, 3*sizeof(float), nParticles, fp);
+	fclose(fp);
+	if(written != nParticles) {
+		fprintf(stderr, "Error writing %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	printf("Wrote %zu particle positions to %s\n", nParticles, filename);
+	return EXIT_SUCCESS;
+}
+
+
+
+// Record: uint64 step, uint64 particle count, then interleaved xyz float32
+static void trajectoryWrite(void *arg, const void *data, size_t bytes, unsigned long long step)
+{
+	trajectoryStream *ts = (trajectoryStream*)arg;
+	unsigned long long header[2] = {step, bytes / (3*sizeof(float))};
+	if(fwrite(header, sizeof(header), 1, ts->fp) != 1 || fwrite(data, 1, bytes, ts->fp) != bytes) {
+		if(!ts->writeError) fprintf(stderr, "Error writing trajectory record at step %llu\n", step);
+		ts->writeError = 1;
+		return;
+	}
+	ts->records++;
+}
+
+
+
+int trajectoryOpen(trajectoryStream *ts, const char *outputDir, unsigned int backend, size_t nParticles)
+{
+	char filename[MAXPATHLENGTH];
+	snprintf(filename, MAXPATHLENGTH, "%s/trajectory.bin", outputDir);
+	ts->fp = fopen(filename, "wb");
+	if(ts->fp == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", filename);
+		return EXIT_FAILURE;
+	}
+	ts->backend = backend;
+	ts->host = NULL;
+	ts->hostParticles = 0;
+	ts->records = 0;
+	ts->writeError = 0;
+	if(backend == BACKEND_GPU && readbackInit(&(ts->ring), nParticles * 3 * sizeof(float))) {
+		fclose(ts->fp);
+		ts->fp = NULL;
+		return EXIT_FAILURE;
+	}
+	printf("Streaming positions to %s\n", filename);
+	return EXIT_SUCCESS;
+}
+
+
+
+// Take a snapshot of the current state. On the gpu backend it is written once a later
+// trajectoryPoll finds the copy complete; snapshots are dropped rather than waited for.
+void trajectorySnapshot(trajectoryStream *ts, openglObjects *oglo, cpuIntegrator *cpu, unsigned long long step)
+{
+	if(ts->fp == NULL) return;
+	if(ts->backend == BACKEND_GPU) {
+		readbackRequest(&(ts->ring), oglo->pos1VBO, oglo->nParticles * 3 * sizeof(float), step);
+		return;
+	}
+
+	if(ts->hostParticles != cpu->nParticles) {
+		free(ts->host);
+		ts->host = (float*)malloc(cpu->nParticles * 3 * sizeof(float));
+		ts->hostParticles = (ts->host != NULL) ? cpu->nParticles : 0;
+		if(ts->host == NULL) {
+			fprintf(stderr, "Error allocating trajectory staging for %zu particles\n", cpu->nParticles);
+			return;
+		}
+	}
+	cpuIntegratorGetPositions(cpu, ts->host);
+	trajectoryWrite(ts, ts->host, cpu->nParticles * 3 * sizeof(float), step);
+}
+
+
+
+void trajectoryPoll(trajectoryStream *ts)
+{
+	if(ts->fp != NULL && ts->backend == BACKEND_GPU) readbackPoll(&(ts->ring), trajectoryWrite, ts);
+}
+
+
+
+void trajectoryClose(trajectoryStream *ts)
+{
+	if(ts->fp == NULL) return;
+	unsigned int dropped = 0;
+	if(ts->backend == BACKEND_GPU) {
+		readbackFlush(&(ts->ring), trajectoryWrite, ts);
+		dropped = ts->ring.dropped;
+		readbackFree(&(ts->ring));
+	}
+	free(ts->host);
+	fclose(ts->fp);
+	ts->fp = NULL;
+	printf("Trajectory: %llu records written, %u dropped\n", ts->records, dropped);
+}
+
+
+
+// Write the state to <outputDir>/checkpoint.snap. The data goes to a temporary file first,
+// so an interrupted write never replaces the previous checkpoint.
+int writeCheckpoint(openglObjects *oglo, const runOptions *opts, cpuIntegrator *cpu, const attractorParameters *params, unsigned long long steps)
+{
+	char filename[MAXPATHLENGTH];
+	char tmpname[MAXPATHLENGTH];
+	snprintf(filename, MAXPATHLENGTH, "%s/checkpoint.snap", opts->outputDir);
+	snprintf(tmpname, MAXPATHLENGTH, "%s/checkpoint.snap.tmp", opts->outputDir);
+
+	snapshotHeader header;
+	snapshotInitHeader(&header);
+	header.flags = (opts->integrator == INTEGRATOR_RK45) ? SNAPSHOTSTEPSIZES : 0;
+	header.integrator = opts->integrator;
+	header.stepSize = opts->stepSize;
+	header.tolerance = opts->tolerance;
+	header.steps = steps;
+	header.nParticles = (opts->backend == BACKEND_CPU) ? cpu->nParticles : oglo->nParticles;
+	memcpy(header.X, params->X, sizeof(header.X));
+	memcpy(header.Y, params->Y, sizeof(header.Y));
+	memcpy(header.Z, params->Z, sizeof(header.Z));
+	size_t n = header.nParticles;
+
+	FILE *fp = fopen(tmpname, "wb");
+	if(fp == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", tmpname);
+		return EXIT_FAILURE;
+	}
+	int status = snapshotWriteHeader(fp, &header);
+	if(status == EXIT_SUCCESS && opts->backend == BACKEND_CPU) {
+		// interleave through a small buffer rather than a copy of the whole state
+		float *chunk = (float*)malloc(CHECKPOINTCHUNK * 3 * sizeof(float));
+		status = (chunk == NULL) ? EXIT_FAILURE : EXIT_SUCCESS;
+		for(size_t first = 0; first < n && status == EXIT_SUCCESS; first += CHECKPOINTCHUNK) {
+			size_t count = (n - first < CHECKPOINTCHUNK) ? n - first : CHECKPOINTCHUNK;
+			for(size_t i = 0; i < count; i++) {
+				chunk[3*i+0] = cpu->x[first+i];
+				chunk[3*i+1] = cpu->y[first+i];
+				chunk[3*i+2] = cpu->z[first+i];
+			}
+			if(fwrite(chunk, 3*sizeof(float), count, fp) != count) status = EXIT_FAILURE;
+		}
+		free(chunk);
+		if(status == EXIT_SUCCESS && (header.flags & SNAPSHOTSTEPSIZES) && fwrite(cpu->h, sizeof(float), n, fp) != n) {
+			status = EXIT_FAILURE;
+		}
+	}
+	else if(status == EXIT_SUCCESS) {
+		// straight from the mapped buffers; waits for the gpu to finish the current state
+		unsigned int buffers[2] = {oglo->pos1VBO, oglo->step1VBO};
+		size_t bytes[2] = {n * 3 * sizeof(float), n * sizeof(float)};
+		for(unsigned int b = 0; b < ((header.flags & SNAPSHOTSTEPSIZES) ? 2u : 1u) && status == EXIT_SUCCESS; b++) {
+			glBindBuffer(GL_ARRAY_BUFFER, buffers[b]);
+			const void *data = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes[b], GL_MAP_READ_BIT);
+			if(data == NULL || fwrite(data, 1, bytes[b], fp) != bytes[b]) status = EXIT_FAILURE;
+			if(data != NULL) glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	if(fclose(fp)) status = EXIT_FAILURE;
+
+	if(status != EXIT_SUCCESS || rename(tmpname, filename)) {
+		fprintf(stderr, "Error writing checkpoint %s\n", filename);
+		remove(tmpname);
+		return EXIT_FAILURE;
+	}
+	printf("Checkpoint at step %llu: %s\n", steps, filename);
+	return EXIT_SUCCESS;
+}
+
+
+
+// Load the state of a mapped snapshot, whose particle count the buffers already have.
+// oglo may be NULL for the cpu backend without OpenGL.
+void restoreParticles(openglObjects *oglo, unsigned int backend, cpuIntegrator *cpu, const snapshotMapping *sm)
+{
+	size_t n = sm->header.nParticles;
+	if(backend == BACKEND_CPU) {
+		cpuIntegratorSetPositions(cpu, sm->positions);
+		if(sm->stepSizes != NULL) memcpy(cpu->h, sm->stepSizes, n * sizeof(float));
+		if(oglo != NULL) uploadCpuPositions(oglo, cpu);
+		return;
+	}
+	updateGLData(&(oglo->pos1VBO), (float*)sm->positions, 3*n);
+	if(oglo->adaptive && sm->stepSizes != NULL) {
+		updateGLData(&(oglo->step1VBO), (float*)sm->stepSizes, n);
+	}
+}
+
+
+
+// Start writing frames of width x height. offscreen: create a framebuffer to draw them into,
+// otherwise they are read from the framebuffer bound when recorderCapture is called.
+int recorderOpen(frameRecorder *fr, const runOptions *opts, unsigned int width, unsigned int height, unsigned int offscreen)
+{
+	fr->width = width;
+	fr->height = height;
+	fr->fbo = 0;
+	fr->texture = 0;
+	fr->error = 0;
+	if(offscreen) {
+		glGenTextures(1, &(fr->texture));
+		glBindTexture(GL_TEXTURE_2D, fr->texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glGenFramebuffers(1, &(fr->fbo));
+		glBindFramebuffer(GL_FRAMEBUFFER, fr->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fr->texture, 0);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if(status != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "Error, incomplete %ux%u recording framebuffer\n", width, height);
+			glDeleteFramebuffers(1, &(fr->fbo));
+			glDeleteTextures(1, &(fr->texture));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(readbackInit(&(fr->ring), 3 * (size_t)width * height)) {
+		if(offscreen) {
+			glDeleteFramebuffers(1, &(fr->fbo));
+			glDeleteTextures(1, &(fr->texture));
+		}
+		return EXIT_FAILURE;
+	}
+	if(frameWriterInit(&(fr->writer), width, height, opts->outputDir, opts->recordPipe)) {
+		readbackFree(&(fr->ring));
+		if(offscreen) {
+			glDeleteFramebuffers(1, &(fr->fbo));
+			glDeleteTextures(1, &(fr->texture));
+		}
+		return EXIT_FAILURE;
+	}
+	printf("Recording %ux%u frames every %u frames to %s\n", width, height, opts->frameInterval,
+		(opts->recordPipe != NULL) ? opts->recordPipe : opts->outputDir);
+	return EXIT_SUCCESS;
+}
+
+
+
+static void recorderWrite(void *arg, const void *data, size_t bytes, unsigned long long tag)
+{
+	frameRecorder *fr = (frameRecorder*)arg;
+	if(fr->error || bytes != 3 * (size_t)fr->width * fr->height) return;
+	if(frameWriterSubmit(&(fr->writer), (const unsigned char*)data, (unsigned int)tag)) fr->error = 1;
+}
+
+
+
+// Queue a readback of the bound framebuffer as frame number. Frames are never dropped:
+// with every slot in flight this waits for the oldest one.
+int recorderCapture(frameRecorder *fr, unsigned int number)
+{
+	if(fr->ring.pending == READBACKSLOTS) readbackWait(&(fr->ring), recorderWrite, fr);
+	readbackRequestPixels(&(fr->ring), fr->width, fr->height, number);
+	return fr->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+
+void recorderPoll(frameRecorder *fr)
+{
+	readbackPoll(&(fr->ring), recorderWrite, fr);
+}
+
+
+
+// Draw the offscreen frame into the window, scaled to fit with black bars, and leave the
+// window framebuffer bound for the text
+void recorderShow(openglObjects *oglo, frameRecorder *fr)
+{
+	int width, height;
+	glfwGetFramebufferSize(oglo->window, &width, &height);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	float scale = fminf((float)width/fr->width, (float)height/fr->height);
+	int viewWidth = scale * fr->width;
+	int viewHeight = scale * fr->height;
+	glViewport((width-viewWidth)/2, (height-viewHeight)/2, viewWidth, viewHeight);
+	glUseProgram(oglo->shaderProgramCopy);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, fr->texture);
+	// nothing is read from the vertex arrays
+	glBindVertexArray(oglo->emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glViewport(0, 0, width, height);
+}
+
+
+
+// Write out every frame in flight and stop the writer
+int recorderClose(frameRecorder *fr)
+{
+	readbackFlush(&(fr->ring), recorderWrite, fr);
+	unsigned int dropped = fr->ring.dropped;
+	readbackFree(&(fr->ring));
+	int status = frameWriterFree(&(fr->writer));
+	if(fr->fbo) {
+		glDeleteFramebuffers(1, &(fr->fbo));
+		glDeleteTextures(1, &(fr->texture));
+	}
+	printf("Recording: %u frames written, %u dropped, writer queue full %u times\n", fr->writer.written,
+		dropped, fr->writer.stalls);
+	return (status || fr->error) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+
+int runBenchmark(openglObjects *oglo, runOptions *opts, const attractorParameters *params)
+{
+	char filename[MAXPATHLENGTH];
+	snprintf(filename, MAXPATHLENGTH, "%s/benchmark.csv", opts->outputDir);
+	FILE *csv = fopen(filename, "w");
+	if(csv == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", filename);
+		return EXIT_FAILURE;
+	}
+	const char *header = "backend,isa,integrator,particles,updates_per_frame,frames,integrate_ms,transform_feedback_ms,"
+		"upload_ms,draw_ms,swap_ms,frame_ms,integration_steps_per_s,frame_steps_per_s\n";
+	fputs(header, csv);
+	printf("Benchmark, results in %s\n%s", filename, header);
+
+	// averages over every frame: waiting for the gpu only slows the sweep down
+	gpuTimer gt;
+	gpuTimerInit(&gt, BENCHGPUNSECTIONS, 1);
+
+	for(unsigned int b = 0; b < opts->nBenchBackends; b++) {
+		unsigned int backend = opts->benchBackends[b];
+		for(unsigned int p = 0; p < opts->nBenchParticles; p++) {
+			size_t nParticles = opts->benchParticles[p];
+
+			// skip sizes which do not fit, rather than abandoning the sweep
+			setParticleFormat(oglo, backend, opts->storage);
+			if(allocateParticleBuffers(oglo, nParticles)) {
+				fprintf(stderr, "Warning: skipping %zu particles, allocation failed\n", nParticles);
+				continue;
+			}
+			cpuIntegrator cpu;
+			if(backend == BACKEND_CPU && cpuIntegratorInit(&cpu, nParticles, opts->nThreads, opts->cpuIsa)) {
+				continue;
+			}
+
+			for(unsigned int u = 0; u < opts->nBenchUpdates; u++) {
+				int updatesPerFrame = opts->benchUpdates[u];
+				randomizeParticles(oglo, backend, &cpu, 0, opts->volSize, opts->seed, 0);
+
+				benchmarkTimes t;
+				benchmarkConfiguration(oglo, opts, &gt, backend, &cpu, nParticles, updatesPerFrame, params, &t);
+
+				double steps = (double)nParticles * updatesPerFrame;
+				double integrationTime = t.integrate + t.transformFeedback;
+				char row[MAXTEXTLENGTH];
+				snprintf(row, MAXTEXTLENGTH, "%s,%s,%s,%zu,%d,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4g,%.4g\n",
+					(backend == BACKEND_CPU) ? "cpu" : "gpu", (backend == BACKEND_CPU) ? cpu.kernels->name : (oglo->compute ? "compute" : "glsl"),
+					integratorName(opts->integrator), nParticles, updatesPerFrame, t.frames, t.integrate, t.transformFeedback, t.upload, t.draw, t.swap, t.frame,
+					(integrationTime > 0.0) ? 1e3*steps/integrationTime : 0.0, (t.frame > 0.0) ? 1e3*steps/t.frame : 0.0);
+				fputs(row, csv);
+				fflush(csv);
+				printf("%s", row);
+			}
+
+			if(backend == BACKEND_CPU) cpuIntegratorFree(&cpu);
+		}
+	}
+
+	gpuTimerFree(&gt);
+	fclose(csv);
+	return EXIT_SUCCESS;
+}
+
+
+
+void benchmarkConfiguration(openglObjects *oglo, runOptions *opts, gpuTimer *gt, unsigned int backend, cpuIntegrator *cpu, size_t nParticles, int updatesPerFrame, const attractorParameters *params, benchmarkTimes *times)
+{
+	double gpuTimes[BENCHGPUNSECTIONS];
+	memset(times, 0, sizeof(benchmarkTimes));
+
+	// warm up caches, shader compilation and buffer residency, then discard
+	for(unsigned int i = 0; i < 2; i++) {
+		benchmarkFrame(oglo, opts, gt, backend, cpu, nParticles, updatesPerFrame, params, times);
+		gpuTimerEndFrame(gt, gpuTimes);
+	}
+	while(gpuTimerFlush(gt, gpuTimes));
+	memset(times, 0, sizeof(benchmarkTimes));
+
+	double startTime = GetWallTime();
+	while(times->frames < opts->benchFrames && (times->frames == 0 || GetWallTime()-startTime < opts->benchTime)) {
+		benchmarkFrame(oglo, opts, gt, backend, cpu, nParticles, updatesPerFrame, params, times);
+		times->frames++;
+		if(gpuTimerEndFrame(gt, gpuTimes)) {
+			times->integrate += gpuTimes[BENCHGPUINTEGRATE];
+			times->draw += gpuTimes[BENCHGPUDRAW];
+			times->gpuFrames++;
+		}
+	}
+	glFinish();
+	times->frame = 1e3 * (GetWallTime()-startTime);
+	while(gpuTimerFlush(gt, gpuTimes)) {
+		times->integrate += gpuTimes[BENCHGPUINTEGRATE];
+		times->draw += gpuTimes[BENCHGPUDRAW];
+		times->gpuFrames++;
+	}
+
+	// averages per frame. gpu sections come from the query results, wall times from every frame
+	unsigned int gpuFrames = (times->gpuFrames > 0) ? times->gpuFrames : 1;
+	if(backend == BACKEND_GPU) times->integrate /= gpuFrames;
+	times->draw /= gpuFrames;
+	if(backend == BACKEND_CPU) times->integrate /= times->frames;
+	times->upload /= times->frames;
+	times->swap /= times->frames;
+	times->frame /= times->frames;
+
+	// The transform feedback pass both integrates and captures. Time a pass with zero
+	// updates, which only streams the buffers through, to split the two.
+	if(backend == BACKEND_GPU) {
+		double capture = 0.0;
+		unsigned int captureFrames = 0;
+		for(unsigned int i = 0; i < 3; i++) {
+			benchmarkFrame(oglo, opts, gt, backend, cpu, nParticles, 0, params, NULL);
+			if(gpuTimerEndFrame(gt, gpuTimes)) {
+				capture += gpuTimes[BENCHGPUINTEGRATE];
+				captureFrames++;
+			}
+		}
+		while(gpuTimerFlush(gt, gpuTimes)) {
+			capture += gpuTimes[BENCHGPUINTEGRATE];
+			captureFrames++;
+		}
+		times->transformFeedback = (captureFrames > 0) ? capture/captureFrames : 0.0;
+		if(times->transformFeedback > times->integrate) times->transformFeedback = times->integrate;
+		times->integrate -= times->transformFeedback;
+	}
+}
+
+
+
+// One frame of the sweep. updatesPerFrame = 0 runs only the gpu integration pass (capture cost);
+// times = NULL skips the wall clock accumulation.
+void benchmarkFrame(openglObjects *oglo, runOptions *opts, gpuTimer *gt, unsigned int backend, cpuIntegrator *cpu, size_t nParticles, int updatesPerFrame, const attractorParameters *params, benchmarkTimes *times)
+{
+	double t;
+	glUseProgram(oglo->shaderProgram);
+
+	if(backend == BACKEND_CPU) {
+		t = GetWallTime();
+		cpuIntegratorStep(cpu, params, opts->integrator, opts->stepSize, updatesPerFrame, opts->tolerance);
+		if(times) times->integrate += 1e3 * (GetWallTime()-t);
+
+		t = GetWallTime();
+		uploadCpuPositions(oglo, cpu);
+		if(times) times->upload += 1e3 * (GetWallTime()-t);
+	}
+	else {
+		// integration and capture, or the in place update, only
+		gpuTimerBegin(gt, BENCHGPUINTEGRATE);
+		integrateParticles(oglo, opts, params, nParticles, updatesPerFrame);
+		gpuTimerEnd(gt);
+		if(updatesPerFrame == 0) return;
+	}
+
+	// draw with a zero-length step: colours only
+	gpuTimerBegin(gt, BENCHGPUDRAW);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	uploadView(oglo);
+	drawCube(oglo);
+	drawParticles(oglo);
+	gpuTimerEnd(gt);
+
+	t = GetWallTime();
+	if(oglo->window != NULL) {
+		glfwSwapBuffers(oglo->window);
+		glfwPollEvents();
+	}
+	if(times) times->swap += 1e3 * (GetWallTime()-t);
+}
+
+
+
+// Error of each benchmark backend after opts->validateTime of simulated time, from the same
+// start as a fine rk4 reference in opts->referencePrecision, for each step size, with the
+// cost of a particle-step at opts->nParticles. Euler and rk4 are also run in the reference
+// precisions, on one thread, to show what more precision buys. Rows are appended to
+// validation.csv, so runs with each integrator can share it.
+int runValidation(openglObjects *oglo, runOptions *opts, const attractorParameters *params)
+{
+	const size_t n = (opts->validateParticles + CPUPADDING - 1) / CPUPADDING * CPUPADDING;
+	const double T = opts->validateTime;
+	const double threshold = VALIDATEDIVERGED * oglo->view.scaleFactor;
+	double stepSizes[MAXBENCHVALUES];
+	unsigned int nStepSizes = opts->nValidateSteps;
+	if(nStepSizes == 0) {
+		const double factors[] = {4.0, 2.0, 1.0, 0.5, 0.25};
+		nStepSizes = sizeof(factors)/sizeof(factors[0]);
+		for(unsigned int i = 0; i < nStepSizes; i++) stepSizes[i] = factors[i] * opts->stepSize;
+	}
+	else {
+		memcpy(stepSizes, opts->validateSteps, nStepSizes * sizeof(double));
+	}
+	double hMin = stepSizes[0];
+	for(unsigned int i = 1; i < nStepSizes; i++) hMin = fmin(hMin, stepSizes[i]);
+	if(!(T > 0.0) || !(hMin > 0.0)) {
+		fprintf(stderr, "Error, validation needs a positive time and step sizes\n");
+		return EXIT_FAILURE;
+	}
+
+	char filename[MAXPATHLENGTH];
+	snprintf(filename, MAXPATHLENGTH, "%s/validation.csv", opts->outputDir);
+	FILE *csv = fopen(filename, "a");
+	if(csv == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", filename);
+		return EXIT_FAILURE;
+	}
+	const char *header = "backend,isa,precision,integrator,step_size,steps,particles,rms_error,median_error,p99_error,"
+		"max_error,diverged,ns_per_particle_step\n";
+	if(ftell(csv) == 0) fputs(header, csv);
+
+	float *start = (float*)malloc(n * 3 * sizeof(float));
+	float *result = (float*)malloc(n * 3 * sizeof(float));
+	double *truth = (double*)malloc(n * 3 * sizeof(double));
+	double *pos = (double*)malloc(n * 3 * sizeof(double));
+	cpuIntegrator sample, cpu;
+	unsigned int cpuCost = 0;
+	for(unsigned int b = 0; b < opts->nBenchBackends; b++) cpuCost |= (opts->benchBackends[b] == BACKEND_CPU);
+	int status = (start == NULL || result == NULL || truth == NULL || pos == NULL) ? EXIT_FAILURE : EXIT_SUCCESS;
+	if(status) {
+		fprintf(stderr, "Error allocating %zu particles for validation\n", n);
+	}
+	else if(cpuIntegratorInit(&sample, n, opts->nThreads, opts->cpuIsa)) {
+		status = EXIT_FAILURE;
+	}
+	else if(cpuCost && cpuIntegratorInit(&cpu, opts->nParticles, opts->nThreads, opts->cpuIsa)) {
+		cpuIntegratorFree(&sample);
+		status = EXIT_FAILURE;
+	}
+	if(status) {
+		free(start);
+		free(result);
+		free(truth);
+		free(pos);
+		fclose(csv);
+		return EXIT_FAILURE;
+	}
+
+	// every run starts where both backends would place the particles
+	cpuIntegratorRandomPositions(&sample, 0, opts->volSize, opts->seed, 0);
+	cpuIntegratorGetPositions(&sample, start);
+
+	// the reference takes an even number of steps to land on T, and is checked against
+	// half as many: the rk4 error falls 16-fold as the step halves
+	unsigned long long nReference = 2 * (unsigned long long)ceil(T * VALIDATESUBSTEPS / (2.0 * hMin));
+	for(size_t i = 0; i < 3*n; i++) truth[i] = pos[i] = start[i];
+	referenceIntegrate(params, opts->referencePrecision, INTEGRATOR_RK4, T / nReference, nReference, truth, n);
+	referenceIntegrate(params, opts->referencePrecision, INTEGRATOR_RK4, 2.0 * T / nReference, nReference / 2, pos, n);
+	referenceErrors e;
+	referenceCompare(pos, truth, n, threshold, &e);
+	printf("Validation of attractor %u, %zu particles at time %g, results in %s\n", opts->attractor, n, T, filename);
+	printf("Reference: rk4 in %s, %llu steps of %g, error about %.3g (median %.3g)\n%s",
+		referencePrecisionName(opts->referencePrecision), nReference, T / nReference, e.max / 15.0, e.median / 15.0, header);
+
+	// averages over every frame: waiting for the gpu only slows the sweep down
+	gpuTimer gt;
+	gpuTimerInit(&gt, BENCHGPUNSECTIONS, 1);
+	for(unsigned int s = 0; s < nStepSizes; s++) {
+		// whole steps to T
+		unsigned long long nSteps = (unsigned long long)llround(T / stepSizes[s]);
+		if(nSteps == 0) nSteps = 1;
+		const double h = T / nSteps;
+		opts->stepSize = (float)h;
+		char row[MAXTEXTLENGTH];
+
+		for(unsigned int b = 0; b < opts->nBenchBackends; b++) {
+			unsigned int backend = opts->benchBackends[b];
+			if(validateSample(oglo, opts, params, backend, &sample, start, nSteps, result)) continue;
+			for(size_t i = 0; i < 3*n; i++) pos[i] = result[i];
+			if(referenceCompare(pos, truth, n, threshold, &e)) continue;
+			double cost = validateCost(oglo, opts, &gt, params, backend, &cpu);
+			snprintf(row, MAXTEXTLENGTH, "%s,%s,float,%s,%.6g,%llu,%zu,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g\n",
+				(backend == BACKEND_CPU) ? "cpu" : "gpu", (backend == BACKEND_CPU) ? cpu.kernels->name : (oglo->compute ? "compute" : "glsl"),
+				integratorName(opts->integrator), opts->stepSize, nSteps, n, e.rms, e.median, e.p99, e.max, e.diverged, cost);
+			fputs(row, csv);
+			fflush(csv);
+			printf("%s", row);
+		}
+
+		// the reference has no adaptive scheme
+		if(opts->integrator == INTEGRATOR_RK45) continue;
+		for(unsigned int p = 0; p < NREFERENCEPRECISIONS; p++) {
+			for(size_t i = 0; i < 3*n; i++) pos[i] = start[i];
+			double t = GetWallTime();
+			referenceIntegrate(params, p, opts->integrator, h, nSteps, pos, n);
+			double cost = 1e9 * (GetWallTime() - t) / ((double)n * nSteps);
+			if(referenceCompare(pos, truth, n, threshold, &e)) continue;
+			snprintf(row, MAXTEXTLENGTH, "reference,scalar,%s,%s,%.6g,%llu,%zu,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g\n",
+				referencePrecisionName(p), integratorName(opts->integrator), h, nSteps, n, e.rms, e.median, e.p99, e.max, e.diverged, cost);
+			fputs(row, csv);
+			fflush(csv);
+			printf("%s", row);
+		}
+	}
+
+	gpuTimerFree(&gt);
+	if(cpuCost) cpuIntegratorFree(&cpu);
+	cpuIntegratorFree(&sample);
+	free(start);
+	free(result);
+	free(truth);
+	free(pos);
+	if(fclose(csv)) {
+		fprintf(stderr, "Error writing %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+// Integrate the validation sample from start by nSteps steps of opts->stepSize on backend,
+// a frame's worth of steps at a time, and fetch the result
+int validateSample(openglObjects *oglo, runOptions *opts, const attractorParameters *params, unsigned int backend,
+	cpuIntegrator *sample, const float *start, unsigned long long nSteps, float *result)
+{
+	const size_t n = sample->nParticles;
+	if(backend == BACKEND_CPU) {
+		cpuIntegratorSetPositions(sample, start);
+		memset(sample->h, 0, sample->nAllocated * sizeof(float));
+		for(unsigned long long done = 0; done < nSteps; done += opts->updatesPerFrame) {
+			unsigned int steps = (nSteps - done < (unsigned long long)opts->updatesPerFrame) ? nSteps - done : opts->updatesPerFrame;
+			cpuIntegratorStep(sample, params, opts->integrator, opts->stepSize, steps, opts->tolerance);
+		}
+		cpuIntegratorGetPositions(sample, result);
+		return EXIT_SUCCESS;
+	}
+
+	setParticleFormat(oglo, backend, opts->storage);
+	if(allocateParticleBuffers(oglo, n)) return EXIT_FAILURE;
+	updateGLData(&(oglo->pos1VBO), (float*)start, 3*n);
+	for(unsigned long long done = 0; done < nSteps; done += opts->updatesPerFrame) {
+		int steps = (nSteps - done < (unsigned long long)opts->updatesPerFrame) ? (int)(nSteps - done) : opts->updatesPerFrame;
+		integrateParticles(oglo, opts, params, n, steps);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos1VBO);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float)*3*n, result);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return EXIT_SUCCESS;
+}
+
+
+
+// ns per particle-step of the integration alone, timed as the benchmark does at
+// opts->nParticles, NaN if they do not fit
+double validateCost(openglObjects *oglo, runOptions *opts, gpuTimer *gt, const attractorParameters *params, unsigned int backend, cpuIntegrator *cpu)
+{
+	setParticleFormat(oglo, backend, opts->storage);
+	if(allocateParticleBuffers(oglo, opts->nParticles)) {
+		fprintf(stderr, "Warning: no cost for %zu particles, allocation failed\n", opts->nParticles);
+		return NAN;
+	}
+	if(backend == BACKEND_CPU) memset(cpu->h, 0, cpu->nAllocated * sizeof(float));
+	randomizeParticles(oglo, backend, cpu, 0, opts->volSize, opts->seed, 0);
+	benchmarkTimes t;
+	benchmarkConfiguration(oglo, opts, gt, backend, cpu, opts->nParticles, opts->updatesPerFrame, params, &t);
+	return 1e6 * (t.integrate + t.transformFeedback) / ((double)opts->nParticles * opts->updatesPerFrame);
+}
+
+
+
+void drawCube(openglObjects *oglo)
+{
+	glUseProgram(oglo->shaderProgramCube);
+	glBindVertexArray(oglo->cubeVAO);
+	glDrawArrays(GL_LINES, 0, 24);
+}
+
+
+
+// Advance the particles by nSteps steps of opts->stepSize
+void advanceParticles(openglObjects *oglo, runOptions *opts, cpuIntegrator *cpu, const attractorParameters *params, unsigned int nSteps)
+{
+	// cpu backend: integrate on the host and upload the new positions, unless they are
+	// binned on the host too
+	if(opts->backend == BACKEND_CPU) {
+		cpuIntegratorStep(cpu, params, opts->integrator, opts->stepSize, nSteps, opts->tolerance);
+		if(opts->render != RENDER_DENSITY) uploadCpuPositions(oglo, cpu);
+	}
+	else {
+		integrateParticles(oglo, opts, params, oglo->nParticles, nSteps);
+		respawnPoll(oglo, 0);
+	}
+	recordTrails(oglo);
+}
+
+
+
+// One gpu pass of nSteps steps over nParticles particles. Transform feedback captures into the
+// other pair of buffers, which then becomes current; compute shaders update in place.
+void integrateParticles(openglObjects *oglo, const runOptions *opts, const attractorParameters *params, size_t nParticles, int nSteps)
+{
+	const integrateProgram *ip = useIntegrateProgram(oglo, params);
+	if(oglo->compute) {
+		setIntegrateUniforms(oglo, ip, opts, nParticles, nSteps);
+		dispatchIntegration(oglo, ip, oglo->pos1VBO, oglo->step1VBO, nParticles);
+		return;
+	}
+
+	// nothing rasterized
+	bindParticleBuffers(oglo, 1);
+	setIntegrateUniforms(oglo, ip, opts, nParticles, nSteps);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, nParticles);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	// output becomes input
+	swapParticleBuffers(oglo);
+}
+
+
+
+// Run the current compute program over the particles of positions and steps, in dispatches
+// of at most maxComputeParticles
+void dispatchIntegration(openglObjects *oglo, const integrateProgram *ip, unsigned int positions, unsigned int steps, size_t nParticles)
+{
+	for(size_t first = 0; first < nParticles; first += oglo->maxComputeParticles) {
+		size_t count = nParticles - first;
+		if(count > oglo->maxComputeParticles) count = oglo->maxComputeParticles;
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, positions, first * 3 * sizeof(float), count * 3 * sizeof(float));
+		if(oglo->adaptive) glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, steps, first * sizeof(float), count * sizeof(float));
+		glUniform1i(ip->firstLocation, (int)first);
+		glUniform1i(ip->countLocation, (int)count);
+		size_t groups = (count + ip->workgroupSize - 1) / ip->workgroupSize;
+		size_t columns = (groups < MAXDISPATCHCOLUMNS) ? groups : MAXDISPATCHCOLUMNS;
+		glDispatchCompute(columns, (groups + columns - 1) / columns, 1);
+	}
+	// next the positions are drawn, read back or copied, or integrated again
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT
+		| GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+
+
+// Time one step of every power of two work group size on a copy of the first particles, and
+// keep the fastest. Neither the particles nor the respawn streams are touched.
+void trialWorkgroupSize(openglObjects *oglo, const runOptions *opts, const attractorParameters *params)
+{
+	size_t n = (oglo->nParticles < WORKGROUPTRIALPARTICLES) ? oglo->nParticles : WORKGROUPTRIALPARTICLES;
+	unsigned int buffers[2] = {0, 0};
+	glGenBuffers(oglo->adaptive ? 2 : 1, buffers);
+	glBindBuffer(GL_COPY_READ_BUFFER, oglo->pos1VBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+	glBufferData(GL_COPY_WRITE_BUFFER, n * 3 * sizeof(float), NULL, GL_STREAM_COPY);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, n * 3 * sizeof(float));
+	if(oglo->adaptive) {
+		glBindBuffer(GL_COPY_READ_BUFFER, oglo->step1VBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+		glBufferData(GL_COPY_WRITE_BUFFER, n * sizeof(float), NULL, GL_STREAM_COPY);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, n * sizeof(float));
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	GLint maxInvocations = 0;
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+	unsigned int respawnStream = oglo->respawnStream;
+	unsigned int best = oglo->workgroupSize;
+	double bestTime = HUGE_VAL;
+	for(unsigned int size = 32; size <= (unsigned int)maxInvocations && size <= 1024; size *= 2) {
+		oglo->workgroupSize = size;
+		const integrateProgram *ip = useIntegrateProgram(oglo, params);
+		setIntegrateUniforms(oglo, ip, opts, n, 1);
+		glUniform1f(ip->boundLocation, 0.0f);
+		// wall time of whole passes, which every implementation can measure; the first is a warm up
+		glFinish();
+		for(unsigned int i = 0; i < 3; i++) {
+			double t = GetWallTime();
+			dispatchIntegration(oglo, ip, buffers[0], buffers[1], n);
+			glFinish();
+			t = GetWallTime() - t;
+			if(i > 0 && t < bestTime) {
+				bestTime = t;
+				best = size;
+			}
+		}
+	}
+	oglo->respawnStream = respawnStream;
+	oglo->workgroupSize = best;
+	glDeleteBuffers(oglo->adaptive ? 2 : 1, buffers);
+	printf("Compute work group size: %u, %.3g particle-steps/s in the trial\n", best, n / bestTime);
+}
+
+
+
+// Make the render program current, with the ensemble layout of the current particle count.
+// Every pass which draws the particles goes through here.
+void useRenderProgram(openglObjects *oglo)
+{
+	glUseProgram(oglo->shaderProgram);
+	glUniform1i(oglo->groupSizeLocation, ensembleGroupSize(oglo));
+}
+
+
+
+// Draw the current state
+void drawParticles(openglObjects *oglo)
+{
+	useRenderProgram(oglo);
+	drawTrails(oglo);
+	if(oglo->cull) {
+		drawCulled(oglo);
+		return;
+	}
+	bindParticleBuffers(oglo, 0);
+	glDrawArrays(GL_POINTS, 0, oglo->nParticles);
+}
+
+
+
+// Allocate, or free, the culled points for every particle. On failure culling stays off.
+int setCulling(openglObjects *oglo, unsigned int cull)
+{
+	if(oglo->cullVBO != 0) {
+		glDeleteBuffers(1, &(oglo->cullVBO));
+		glDeleteTransformFeedbacks(1, &(oglo->cullTFO));
+		glDeleteVertexArrays(1, &(oglo->cullInputVAO));
+		glDeleteVertexArrays(1, &(oglo->cullVAO));
+		oglo->cullVBO = 0;
+		oglo->cullTFO = 0;
+	}
+	oglo->cull = 0;
+	oglo->lodStride = 1;
+	if(!cull) return EXIT_SUCCESS;
+	if(oglo->shaderProgramCull == 0) {
+		printf("Culling needs OpenGL 4.0, drawing every particle\n");
+		return EXIT_FAILURE;
+	}
+
+	// position and index of each
+	while(glGetError() != GL_NO_ERROR);
+	glGenBuffers(1, &(oglo->cullVBO));
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->cullVBO);
+	glBufferData(GL_ARRAY_BUFFER, oglo->nParticles * 4 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(glGetError() == GL_OUT_OF_MEMORY) {
+		fprintf(stderr, "Error, out of memory allocating culled points for %zu particles\n", oglo->nParticles);
+		glDeleteBuffers(1, &(oglo->cullVBO));
+		oglo->cullVBO = 0;
+		return EXIT_FAILURE;
+	}
+	glGenTransformFeedbacks(1, &(oglo->cullTFO));
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, oglo->cullTFO);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, oglo->cullVBO);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	glGenVertexArrays(1, &(oglo->cullInputVAO));
+	glBindVertexArray(oglo->cullInputVAO);
+	glEnableVertexAttribArray(0);
+	glGenVertexArrays(1, &(oglo->cullVAO));
+	glBindVertexArray(oglo->cullVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->cullVBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+	glVertexAttribIPointer(2, 1, GL_INT, 4 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(2);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	oglo->cull = 1;
+	return EXIT_SUCCESS;
+}
+
+
+
+// Draw every lodStride-th particle in view, with the render program in use. The stride keeps
+// about LODPARTICLESPERPIXEL particles per pixel of the cube.
+void drawCulled(openglObjects *oglo)
+{
+	unsigned int stride = 1;
+	while(stride < MAXLODSTRIDE && (double)oglo->nParticles / (2*stride) >= LODPARTICLESPERPIXEL * (double)oglo->footprint) {
+		stride *= 2;
+	}
+	oglo->lodStride = stride;
+
+	// the view comes from the shared uniform block
+	glUseProgram(oglo->shaderProgramCull);
+	glUniform1i(oglo->cullGroupSizeLocation, ensembleGroupSize(oglo));
+	glUniform1i(oglo->cullLodStrideLocation, stride);
+
+	// the strided particles in, the visible ones out. The current buffer and the stride may
+	// both change from frame to frame.
+	glBindVertexArray(oglo->cullInputVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos1VBO);
+	if(oglo->halfPositions) {
+		glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride * 3 * sizeof(unsigned short), (void*)0);
+	}
+	else {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride * 3 * sizeof(float), (void*)0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, oglo->cullTFO);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, (oglo->nParticles + stride - 1) / stride);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+	glUseProgram(oglo->shaderProgram);
+	glUniform1i(oglo->culledLocation, 1);
+	glUniform1i(oglo->lodStrideLocation, stride);
+	glBindVertexArray(oglo->cullVAO);
+	glDrawTransformFeedback(GL_POINTS, oglo->cullTFO);
+	glUniform1i(oglo->culledLocation, 0);
+	glUniform1i(oglo->lodStrideLocation, 1);
+}
+
+
+
+// Keep trails of length past positions, of as many particles, spread evenly over them, as fit
+// in memory bytes. Length 0 frees the ring. The trails start empty. On failure there are none.
+int setTrails(openglObjects *oglo, unsigned int length, size_t memory)
+{
+	if(oglo->trailVBO != 0) {
+		glDeleteBuffers(1, &(oglo->trailVBO));
+		glDeleteTextures(1, &(oglo->trailTexture));
+		oglo->trailVBO = 0;
+		oglo->trailTexture = 0;
+	}
+	oglo->trailLength = 0;
+	oglo->trailFilled = 0;
+	if(length == 0) return EXIT_SUCCESS;
+
+	// particles are gathered from, and the ring is drawn through, texture buffers of limited size
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	size_t n = (oglo->nParticles < (size_t)oglo->maxPositions) ? oglo->nParticles : (size_t)oglo->maxPositions;
+	size_t particles = memory / ((size_t)length * 3 * sizeof(float));
+	if(particles > (size_t)maxTexels / 3 / length) particles = (size_t)maxTexels / 3 / length;
+	if(particles > n) particles = n;
+	if(particles == 0) {
+		fprintf(stderr, "Error, trails of %u positions do not fit in %.3g MB\n", length, (double)memory / (1 << 20));
+		return EXIT_FAILURE;
+	}
+	oglo->trailStride = (unsigned int)((n + particles - 1) / particles);
+	oglo->trailParticles = (n + oglo->trailStride - 1) / oglo->trailStride;
+
+	while(glGetError() != GL_NO_ERROR);
+	glGenBuffers(1, &(oglo->trailVBO));
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->trailVBO);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)length * oglo->trailParticles * 3 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(glGetError() == GL_OUT_OF_MEMORY) {
+		fprintf(stderr, "Error, out of memory allocating trails of %zu particles\n", oglo->trailParticles);
+		glDeleteBuffers(1, &(oglo->trailVBO));
+		oglo->trailVBO = 0;
+		return EXIT_FAILURE;
+	}
+	glGenTextures(1, &(oglo->trailTexture));
+	glActiveTexture(GL_TEXTURE0 + TRAILTEXTUREUNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, oglo->trailTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, oglo->trailVBO);
+	glActiveTexture(GL_TEXTURE0);
+
+	oglo->trailLength = length;
+	oglo->trailMemory = memory;
+	oglo->trailHead = length - 1;
+	printf("Trails: %u positions of %zu particles, %.3g MB\n", length, oglo->trailParticles,
+		(double)length * oglo->trailParticles * 3 * sizeof(float) / (1 << 20));
+	return EXIT_SUCCESS;
+}
+
+
+
+// Write the current positions of the trail particles over the oldest slot of the ring
+void recordTrails(openglObjects *oglo)
+{
+	if(oglo->trailLength == 0) return;
+	unsigned int slot = (oglo->trailHead + 1) % oglo->trailLength;
+	size_t bytes = oglo->trailParticles * 3 * sizeof(float);
+
+	glUseProgram(oglo->shaderProgramTrail);
+	glUniform1i(oglo->trailStrideLocation, oglo->trailStride);
+	glActiveTexture(GL_TEXTURE0 + POSITIONTEXTUREUNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, oglo->positionTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, oglo->halfPositions ? GL_R16F : GL_R32F, oglo->pos1VBO);
+	glActiveTexture(GL_TEXTURE0);
+	// nothing is read from attributes
+	glBindVertexArray(oglo->emptyVAO);
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, oglo->trailVBO, slot * bytes, bytes);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, oglo->trailParticles);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	oglo->trailHead = slot;
+	if(oglo->trailFilled < oglo->trailLength) oglo->trailFilled++;
+}
+
+
+
+// One instanced draw of line strips through the positions recorded so far, with the render
+// program in use
+void drawTrails(openglObjects *oglo)
+{
+	if(oglo->trailLength == 0 || oglo->trailFilled < 2) return;
+	glUniform1i(oglo->trailLengthLocation, oglo->trailLength);
+	glUniform1i(oglo->trailHeadLocation, oglo->trailHead);
+	glUniform1i(oglo->trailParticlesLocation, (int)oglo->trailParticles);
+	glUniform1i(oglo->trailStrideDrawLocation, oglo->trailStride);
+	glBindVertexArray(oglo->emptyVAO);
+	glDrawArraysInstanced(GL_LINE_STRIP, 0, oglo->trailFilled, oglo->trailParticles);
+	glUniform1i(oglo->trailLengthLocation, 0);
+}
+
+
+
+// Clear the bound framebuffer and draw the cube and particles
+void drawFrame(openglObjects *oglo, const runOptions *opts, cpuIntegrator *cpu)
+{
+	uploadView(oglo);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	if(opts->render == RENDER_DENSITY) {
+		frameProfilerBegin(oglo->profiler, PROFILEPARTICLES);
+		drawDensity(oglo, opts, cpu);
+		frameProfilerEnd(oglo->profiler);
+		frameProfilerBegin(oglo->profiler, PROFILECUBE);
+		drawCube(oglo);
+		frameProfilerEnd(oglo->profiler);
+	}
+	else {
+		frameProfilerBegin(oglo->profiler, PROFILECUBE);
+		drawCube(oglo);
+		frameProfilerEnd(oglo->profiler);
+		frameProfilerBegin(oglo->profiler, PROFILEPARTICLES);
+		drawParticles(oglo);
+		frameProfilerEnd(oglo->profiler);
+	}
+}
+
+
+
+// Per-pixel particle counts of width x height, the size of the framebuffer they are shown in
+int densityInit(openglObjects *oglo, unsigned int backend, unsigned int width, unsigned int height)
+{
+	oglo->densityWidth = width;
+	oglo->densityHeight = height;
+	oglo->densityFrames = 0;
+	glGenTextures(1, &(oglo->densityTex));
+	glBindTexture(GL_TEXTURE_2D, oglo->densityTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if(backend == BACKEND_CPU) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+		oglo->densityCounts = (unsigned int*)malloc((size_t)width * height * sizeof(unsigned int));
+		if(oglo->densityCounts == NULL) {
+			fprintf(stderr, "Error allocating %ux%u density counts\n", width, height);
+			densityFree(oglo);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// float counts add up exactly to 2^24 per pixel
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, NULL);
+	glGenFramebuffers(1, &(oglo->densityFBO));
+	glBindFramebuffer(GL_FRAMEBUFFER, oglo->densityFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, oglo->densityTex, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, (oglo->window != NULL) ? 0 : oglo->frameFBO);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Error, incomplete %ux%u density framebuffer\n", width, height);
+		densityFree(oglo);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+void densityFree(openglObjects *oglo)
+{
+	if(oglo->densityFBO) glDeleteFramebuffers(1, &(oglo->densityFBO));
+	if(oglo->densityTex) glDeleteTextures(1, &(oglo->densityTex));
+	free(oglo->densityCounts);
+	oglo->densityFBO = 0;
+	oglo->densityTex = 0;
+	oglo->densityCounts = NULL;
+}
+
+
+
+// Count the particles per pixel, accumulating over frames with opts->accumulate, then
+// tone-map the counts into the bound framebuffer in one fullscreen pass. The log scale is
+// relative to the mean count per pixel, so the image does not depend on the particle count
+// or the number of frames summed.
+void drawDensity(openglObjects *oglo, const runOptions *opts, cpuIntegrator *cpu)
+{
+	const unsigned int width = oglo->densityWidth;
+	const unsigned int height = oglo->densityHeight;
+	if(!opts->accumulate) oglo->densityFrames = 0;
+
+	if(opts->backend == BACKEND_CPU) {
+		if(oglo->densityFrames == 0) memset(oglo->densityCounts, 0, (size_t)width * height * sizeof(unsigned int));
+		// the transformation of the point shader
+		const viewBlock *v = &(oglo->view);
+		glm::mat4 transform = v->perspectiveMatrix * v->cameraMatrix * v->translationMatrix * v->rotationMatrix
+			* glm::scale(glm::mat4(1.0f), glm::vec3(1.0f/v->scaleFactor));
+		cpuIntegratorDensity(cpu, glm::value_ptr(transform), oglo->densityCounts, width, height);
+
+		glBindTexture(GL_TEXTURE_2D, oglo->densityTex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, oglo->densityCounts);
+	}
+	else {
+		int target, viewport[4];
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glBindFramebuffer(GL_FRAMEBUFFER, oglo->densityFBO);
+		glViewport(0, 0, width, height);
+		if(oglo->densityFrames == 0) glClear(GL_COLOR_BUFFER_BIT);
+		glBlendFunc(GL_ONE, GL_ONE);
+		useRenderProgram(oglo);
+		glUniform1i(oglo->densityLocation, 1);
+		bindParticleBuffers(oglo, 0);
+		glDrawArrays(GL_POINTS, 0, oglo->nParticles);
+		glUniform1i(oglo->densityLocation, 0);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	}
+	oglo->densityFrames++;
+
+	double reference = (double)oglo->densityFrames * oglo->nParticles / ((double)width * height);
+	glUseProgram(oglo->shaderProgramToneMap);
+	glUniform1f(oglo->inverseReferenceLocation, 1.0 / reference);
+	glUniform1f(oglo->inverseLogPeakLocation, 1.0 / log(1.0 + DENSITYPEAK));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, oglo->densityTex);
+	// nothing is read from the vertex arrays
+	glBindVertexArray(oglo->emptyVAO);
+	glDisable(GL_BLEND);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_BLEND);
+}
+
+
+
+int parseCommandLine(int argc, char **argv, runOptions *opts)
+{
+	opts->backend = BACKEND_GPU;
+	opts->nParticles = DEFAULTNPARTICLES;
+	opts->nThreads = 0;
+	opts->cpuIsa = NULL;
+	opts->integrator = INTEGRATOR_EULER;
+	opts->tolerance = DEFAULTTOLERANCE;
+	opts->storage = STORAGE_FLOAT;
+	opts->render = RENDER_POINTS;
+	opts->accumulate = 0;
+	opts->seed = 0;
+	opts->respawn = 1;
+	opts->compute = 0;
+	opts->workgroupSize = 0;
+	opts->profile = 0;
+	opts->trailLength = 0;
+	opts->trailMemory = (size_t)DEFAULTTRAILMEMORY << 20;
+	opts->cull = 0;
+	opts->trajectoryInterval = 0;
+	opts->checkpointInterval = 0;
+	opts->restoreFile = NULL;
+	opts->recordPipe = NULL;
+	opts->recordWidth = 0;
+	opts->recordHeight = 0;
+	opts->attractor = 1;
+	opts->attractorFile = NULL;
+	opts->ensemble = 0;
+	opts->stepSize = 0.0f;
+	opts->volSize = 0.0f;
+	opts->updatesPerFrame = 10;
+	opts->xres = 1920;
+	opts->yres = 1200;
+	opts->simRate = 0.0;
+	opts->vsync = 1;
+	opts->headless = 0;
+	opts->nFrames = 1000;
+	opts->frameInterval = 0;
+	opts->outputDir = ".";
+	opts->benchmark = 0;
+	opts->benchFrames = 20;
+	opts->benchTime = 2.0;
+	opts->validate = 0;
+	opts->nValidateSteps = 0;
+	opts->validateParticles = DEFAULTVALIDATEPARTICLES;
+	opts->validateTime = 1.0;
+	opts->referencePrecision = REFERENCE_DOUBLE;
+	sweepDefaults(&(opts->sweep));
+
+	double values[MAXBENCHVALUES];
+	const double defaultParticles[] = {1e4, 1e5, 1e6, 1e7};
+	opts->nBenchParticles = sizeof(defaultParticles)/sizeof(defaultParticles[0]);
+	for(unsigned int i = 0; i < opts->nBenchParticles; i++) opts->benchParticles[i] = defaultParticles[i];
+	const int defaultUpdates[] = {1, 10, 100, 1000};
+	opts->nBenchUpdates = sizeof(defaultUpdates)/sizeof(defaultUpdates[0]);
+	for(unsigned int i = 0; i < opts->nBenchUpdates; i++) opts->benchUpdates[i] = defaultUpdates[i];
+	opts->nBenchBackends = 2;
+	opts->benchBackends[0] = BACKEND_GPU;
+	opts->benchBackends[1] = BACKEND_CPU;
+
+	const struct option longOptions[] = {
+		{"backend", required_argument, NULL, 'b'},
+		{"compute", no_argument, NULL, OPTCOMPUTE},
+		{"workgroup-size", required_argument, NULL, OPTWORKGROUPSIZE},
+		{"particles", required_argument, NULL, 'N'},
+		{"threads", required_argument, NULL, 'j'},
+		{"storage", required_argument, NULL, OPTSTORAGE},
+		{"cpu-isa", required_argument, NULL, 'i'},
+		{"attractor", required_argument, NULL, 'a'},
+		{"attractors", required_argument, NULL, OPTATTRACTORS},
+		{"ensemble", no_argument, NULL, OPTENSEMBLE},
+		{"integrator", required_argument, NULL, 'I'},
+		{"tolerance", required_argument, NULL, OPTTOLERANCE},
+		{"step-size", required_argument, NULL, 's'},
+		{"updates-per-frame", required_argument, NULL, 'u'},
+		{"resolution", required_argument, NULL, 'r'},
+		{"sim-rate", required_argument, NULL, OPTSIMRATE},
+		{"no-vsync", no_argument, NULL, OPTNOVSYNC},
+		{"headless", no_argument, NULL, 'H'},
+		{"frames", required_argument, NULL, 'n'},
+		{"frame-interval", required_argument, NULL, 'f'},
+		{"output", required_argument, NULL, 'o'},
+		{"seed", required_argument, NULL, OPTSEED},
+		{"no-respawn", no_argument, NULL, OPTNORESPAWN},
+		{"profile", no_argument, NULL, OPTPROFILE},
+		{"trails", required_argument, NULL, OPTTRAILS},
+		{"trail-memory", required_argument, NULL, OPTTRAILMEMORY},
+		{"cull", no_argument, NULL, OPTCULL},
+		{"trajectory", required_argument, NULL, OPTTRAJECTORY},
+		{"checkpoint", required_argument, NULL, OPTCHECKPOINT},
+		{"restore", required_argument, NULL, OPTRESTORE},
+		{"record-pipe", required_argument, NULL, OPTRECORDPIPE},
+		{"record-resolution", required_argument, NULL, OPTRECORDRESOLUTION},
+		{"render", required_argument, NULL, OPTRENDER},
+		{"accumulate", no_argument, NULL, OPTACCUMULATE},
+		{"benchmark", no_argument, NULL, 'B'},
+		{"bench-particles", required_argument, NULL, OPTBENCHPARTICLES},
+		{"bench-updates", required_argument, NULL, OPTBENCHUPDATES},
+		{"bench-backends", required_argument, NULL, OPTBENCHBACKENDS},
+		{"bench-frames", required_argument, NULL, OPTBENCHFRAMES},
+		{"bench-time", required_argument, NULL, OPTBENCHTIME},
+		{"validate", no_argument, NULL, OPTVALIDATE},
+		{"validate-steps", required_argument, NULL, OPTVALIDATESTEPS},
+		{"validate-particles", required_argument, NULL, OPTVALIDATEPARTICLES},
+		{"validate-time", required_argument, NULL, OPTVALIDATETIME},
+		{"reference", required_argument, NULL, OPTREFERENCE},
+		{"sweep", required_argument, NULL, OPTSWEEP},
+		{"sweep-time", required_argument, NULL, OPTSWEEPTIME},
+		{"sweep-transient", required_argument, NULL, OPTSWEEPTRANSIENT},
+		{"sweep-particles", required_argument, NULL, OPTSWEEPPARTICLES},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int c;
+	while((c = getopt_long(argc, argv, "b:N:j:i:a:I:s:u:r:Hn:f:o:Bh", longOptions, NULL)) != -1) {
+		switch(c) {
+			case 'b':
+				if(!strcmp(optarg, "gpu")) opts->backend = BACKEND_GPU;
+				else if(!strcmp(optarg, "cpu")) opts->backend = BACKEND_CPU;
+				else {
+					fprintf(stderr, "Error, unrecognised backend %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPTCOMPUTE:
+				opts->compute = 1;
+				break;
+			case OPTWORKGROUPSIZE:
+				opts->workgroupSize = atoi(optarg);
+				break;
+			case OPTTRAILS:
+				opts->trailLength = atoi(optarg);
+				if(opts->trailLength == 1) opts->trailLength = 2;
+				break;
+			case OPTTRAILMEMORY:
+				opts->trailMemory = (size_t)(atof(optarg) * (1 << 20));
+				break;
+			case OPTCULL:
+				opts->cull = 1;
+				break;
+			case 'N':
+				opts->nParticles = (size_t)strtod(optarg, NULL);
+				if(opts->nParticles < MINNPARTICLES) opts->nParticles = MINNPARTICLES;
+				break;
+			case 'j':
+				opts->nThreads = atoi(optarg);
+				break;
+			case OPTSTORAGE:
+				if(!strcmp(optarg, "float")) opts->storage = STORAGE_FLOAT;
+				else if(!strcmp(optarg, "half")) opts->storage = STORAGE_HALF;
+				else {
+					fprintf(stderr, "Error, unrecognised storage format %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'i':
+				opts->cpuIsa = optarg;
+				break;
+			case 'a':
+				opts->attractor = atoi(optarg);
+				break;
+			case OPTATTRACTORS:
+				opts->attractorFile = optarg;
+				break;
+			case OPTENSEMBLE:
+				opts->ensemble = 1;
+				break;
+			case 'I':
+				if(getIntegrator(optarg, &(opts->integrator))) return EXIT_FAILURE;
+				break;
+			case OPTTOLERANCE:
+				opts->tolerance = atof(optarg);
+				break;
+			case 's':
+				opts->stepSize = atof(optarg);
+				break;
+			case 'u':
+				opts->updatesPerFrame = atoi(optarg);
+				break;
+			case 'r':
+				if(sscanf(optarg, "%ux%u", &(opts->xres), &(opts->yres)) != 2 || opts->xres == 0 || opts->yres == 0) {
+					fprintf(stderr, "Error, resolution should be WIDTHxHEIGHT, got %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPTSIMRATE:
+				opts->simRate = atof(optarg);
+				break;
+			case OPTNOVSYNC:
+				opts->vsync = 0;
+				break;
+			case 'H':
+				opts->headless = 1;
+				break;
+			case 'n':
+				opts->nFrames = atoi(optarg);
+				break;
+			case 'f':
+				opts->frameInterval = atoi(optarg);
+				break;
+			case 'o':
+				opts->outputDir = optarg;
+				break;
+			case OPTSEED:
+				opts->seed = strtoul(optarg, NULL, 0);
+				break;
+			case OPTNORESPAWN:
+				opts->respawn = 0;
+				break;
+			case OPTPROFILE:
+				opts->profile = 1;
+				break;
+			case OPTTRAJECTORY:
+				opts->trajectoryInterval = atoi(optarg);
+				break;
+			case OPTCHECKPOINT:
+				opts->checkpointInterval = atoi(optarg);
+				break;
+			case OPTRESTORE:
+				opts->restoreFile = optarg;
+				break;
+			case OPTRENDER:
+				if(!strcmp(optarg, "points")) opts->render = RENDER_POINTS;
+				else if(!strcmp(optarg, "density")) opts->render = RENDER_DENSITY;
+				else {
+					fprintf(stderr, "Error, unrecognised render mode %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case OPTACCUMULATE:
+				opts->accumulate = 1;
+				break;
+			case OPTRECORDPIPE:
+				opts->recordPipe = optarg;
+				break;
+			case OPTRECORDRESOLUTION:
+				if(sscanf(optarg, "%ux%u", &(opts->recordWidth), &(opts->recordHeight)) != 2 || opts->recordWidth == 0 || opts->recordHeight == 0) {
+					fprintf(stderr, "Error, recording resolution should be WIDTHxHEIGHT, got %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'B':
+				opts->benchmark = 1;
+				break;
+			case OPTBENCHPARTICLES:
+				opts->nBenchParticles = parseList(optarg, values, MAXBENCHVALUES);
+				for(unsigned int i = 0; i < opts->nBenchParticles; i++) opts->benchParticles[i] = (size_t)values[i];
+				break;
+			case OPTBENCHUPDATES:
+				opts->nBenchUpdates = parseList(optarg, values, MAXBENCHVALUES);
+				for(unsigned int i = 0; i < opts->nBenchUpdates; i++) opts->benchUpdates[i] = (int)values[i];
+				break;
+			case OPTBENCHBACKENDS:
+				opts->nBenchBackends = 0;
+				for(const char *s = optarg; *s && opts->nBenchBackends < MAXBENCHVALUES; s += strcspn(s, ",")) {
+					if(*s == ',') s++;
+					if(!strncmp(s, "gpu", 3)) opts->benchBackends[opts->nBenchBackends++] = BACKEND_GPU;
+					else if(!strncmp(s, "cpu", 3)) opts->benchBackends[opts->nBenchBackends++] = BACKEND_CPU;
+					else {
+						fprintf(stderr, "Error, unrecognised backend in %s\n", optarg);
+						return EXIT_FAILURE;
+					}
+				}
+				break;
+			case OPTBENCHFRAMES:
+				opts->benchFrames = atoi(optarg);
+				break;
+			case OPTBENCHTIME:
+				opts->benchTime = atof(optarg);
+				break;
+			case OPTVALIDATE:
+				opts->validate = 1;
+				break;
+			case OPTVALIDATESTEPS:
+				opts->nValidateSteps = parseList(optarg, opts->validateSteps, MAXBENCHVALUES);
+				break;
+			case OPTVALIDATEPARTICLES:
+				opts->validateParticles = (size_t)strtod(optarg, NULL);
+				if(opts->validateParticles == 0) opts->validateParticles = 1;
+				break;
+			case OPTVALIDATETIME:
+				opts->validateTime = atof(optarg);
+				break;
+			case OPTREFERENCE:
+				if(getReferencePrecision(optarg, &(opts->referencePrecision))) return EXIT_FAILURE;
+				break;
+			case OPTSWEEP:
+				if(opts->sweep.nAxes == MAXSWEEPAXES) {
+					fprintf(stderr, "Error, at most %u sweep coefficients\n", MAXSWEEPAXES);
+					return EXIT_FAILURE;
+				}
+				if(sweepParseAxis(optarg, &(opts->sweep.axes[opts->sweep.nAxes]))) return EXIT_FAILURE;
+				opts->sweep.nAxes++;
+				break;
+			case OPTSWEEPTIME:
+				opts->sweep.time = atof(optarg);
+				break;
+			case OPTSWEEPTRANSIENT:
+				opts->sweep.transient = atof(optarg);
+				break;
+			case OPTSWEEPPARTICLES:
+				// whole vector blocks of pairs
+				opts->sweep.cloudSize = ((unsigned int)strtod(optarg, NULL) + CPUPADDING - 1) / CPUPADDING * CPUPADDING;
+				if(opts->sweep.cloudSize == 0) opts->sweep.cloudSize = CPUPADDING;
+				break;
+			case 'h':
+			default:
+				printf("Usage: %s [options]\n"
+					"   -b, --backend gpu|cpu ------------- integrate with transform feedback or on the cpu\n"
+					"       --compute --------------------- gpu backend: integrate in place with compute shaders,\n"
+					"                                       where OpenGL 4.3 is available\n"
+					"       --workgroup-size N ------------ compute shader work group size (default: the fastest\n"
+					"                                       in a short trial)\n"
+					"   -N, --particles N ----------------- number of particles (default: 2.5e6)\n"
+					"   -j, --threads N ------------------- cpu backend worker threads (default: all cpus)\n"
+					"       --storage float|half ---------- cpu backend format of uploaded positions (default: float)\n"
+					"   -i, --cpu-isa generic|avx2|avx512 - force cpu kernel instruction set\n"
+					"   -a, --attractor N ----------------- initial attractor (default: 1, Lorenz)\n"
+					"       --attractors FILE ------------- attractor definitions to use instead of the built-ins,\n"
+					"                                       reloaded when the file changes\n"
+					"       --ensemble -------------------- integrate all of them at once, side by side, each with\n"
+					"                                       an equal share of the particles\n"
+					"   -I, --integrator euler|rk4|rk45 --- integration scheme (default: euler)\n"
+					"       --tolerance TOL --------------- rk45 error tolerance (default: 1e-5)\n"
+					"   -s, --step-size H ----------------- integration step size (default: the attractor's, or 0.001)\n"
+					"   -u, --updates-per-frame N --------- integration steps per frame (default: 10)\n"
+					"   -r, --resolution WxH -------------- window or image resolution (default: 1920x1200)\n"
+					"       --render points|density ------- alpha-blended points, or log-scaled particle counts per\n"
+					"                                       pixel (default: points)\n"
+					"       --accumulate ------------------ density: sum the counts over frames until the view changes\n"
+					"       --sim-rate R ------------------ simulated time per second (default: 60 frames' worth of updates)\n"
+					"       --no-vsync -------------------- draw as fast as possible\n"
+					"       --profile --------------------- show frame phase times from the start and log them\n"
+					"                                       to profile.csv in the output directory\n"
+					"       --trails K -------------------- draw the last K positions of particles as fading\n"
+					"                                       trails (default: off, v key interactively, 32)\n"
+					"       --trail-memory MB ------------- trails of fewer particles beyond this (default: 256)\n"
+					"       --cull ------------------------ points: draw only those in view, and fewer where many\n"
+					"                                       share a pixel (c key interactively)\n"
+					"   -H, --headless -------------------- batch mode without a window\n"
+					"   -n, --frames N -------------------- headless: frames to integrate (default: 1000)\n"
+					"   -f, --frame-interval N ------------ write an image every N frames (default: never)\n"
+					"   -o, --output DIR ------------------ headless: output directory (default: .)\n"
+					"       --seed S ---------------------- random initial positions (default: 0)\n"
+					"       --no-respawn ------------------ gpu backend: leave particles which escape to infinity\n"
+					"       --trajectory N ---------------- stream positions to trajectory.bin in the output\n"
+					"                                       directory every N frames (default: never)\n"
+					"       --checkpoint N ---------------- write checkpoint.snap to the output directory every\n"
+					"                                       N frames (default: never, k key interactively)\n"
+					"       --restore FILE ---------------- continue from a checkpoint: particles, flow, integrator\n"
+					"                                       and step size come from the snapshot\n"
+					"       --record-pipe CMD ------------- pipe frames as raw rgb24 into the stdin of CMD instead of\n"
+					"                                       writing images, every frame unless -f is given\n"
+					"       --record-resolution WxH ------- resolution of the written frames (default: -r)\n"
+					"   -B, --benchmark ------------------- sweep particle counts, steps per frame and backends,\n"
+					"                                       writing benchmark.csv to the output directory\n"
+					"       --bench-particles LIST -------- (default: 1e4,1e5,1e6,1e7)\n"
+					"       --bench-updates LIST ---------- (default: 1,10,100,1000)\n"
+					"       --bench-backends LIST --------- (default: gpu,cpu)\n"
+					"       --bench-frames N -------------- maximum timed frames per configuration (default: 20)\n"
+					"       --bench-time S ---------------- stop timing a configuration after S seconds (default: 2)\n"
+					"       --validate -------------------- error of the backends against a reference integrator, and\n"
+					"                                       their cost per particle-step at -N particles, appended\n"
+					"                                       to validation.csv in the output directory\n"
+					"       --validate-steps LIST --------- step sizes (default: 4,2,1,1/2,1/4 times the attractor's)\n"
+					"       --validate-particles N -------- particles compared (default: 1024)\n"
+					"       --validate-time T ------------- simulated time compared after (default: 1)\n"
+					"       --reference double|long ------- precision of the reference (default: double)\n"
+					"       --sweep COEFF=MIN:MAX:N ------- map the largest Lyapunov exponent over N values of a\n"
+					"                                       coefficient such as dy:x, twice for a 2-D map, on the\n"
+					"                                       cpu; writes sweep.csv and sweep.ppm to the output directory\n"
+					"       --sweep-time T ---------------- simulated time the exponent is averaged over (default: 50)\n"
+					"       --sweep-transient T ----------- simulated time discarded first (default: 10)\n"
+					"       --sweep-particles N ----------- particles per point, in perturbed pairs (default: 32)\n"
+					, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	// validation times the backends as the benchmark does, without a window. Every particle
+	// is compared with the reference, so none may be respawned.
+	if(opts->validate) {
+		opts->benchmark = 1;
+		opts->headless = 1;
+		opts->respawn = 0;
+	}
+	// the benchmark times the point renderer
+	if(opts->benchmark) opts->render = RENDER_POINTS;
+	if(opts->ensemble && opts->render == RENDER_DENSITY && opts->backend == BACKEND_CPU) {
+		fprintf(stderr, "Error, ensembles are only drawn as density by the gpu backend\n");
+		return EXIT_FAILURE;
+	}
+	// pipe to an encoder: every frame unless told otherwise
+	if(opts->recordPipe != NULL && opts->frameInterval == 0) opts->frameInterval = 1;
+	// headless frames are read straight from the rendered image
+	if(opts->headless && opts->recordWidth) {
+		opts->xres = opts->recordWidth;
+		opts->yres = opts->recordHeight;
+	}
+
+	if((opts->headless || opts->benchmark || opts->sweep.nAxes || opts->profile || opts->trajectoryInterval || opts->checkpointInterval || opts->frameInterval) && mkdir(opts->outputDir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Error creating output directory %s\n", opts->outputDir);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+
+
+// Comma separated numbers, which may use exponents (1e6)
+unsigned int parseList(const char *list, double *values, unsigned int maxValues)
+{
+	unsigned int n = 0;
+	const char *s = list;
+	while(*s && n < maxValues) {
+		char *end;
+		values[n++] = strtod(s, &end);
+		if(end == s) break;
+		s = (*end == ',') ? end+1 : end;
+	}
+	return n;
+}
+
+
+
+int setupWindow(openglObjects *oglo, callbackVariables *cbVars, const unsigned int xres, const unsigned int yres, unsigned int vsync)
+{
+	glfwInit();
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef FOROSX
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	glfwWindowHint(GLFW_SAMPLES, 4);
+
+	//oglo->window = glfwCreateWindow(xres, yres, "attractors", NULL, NULL);
+	// For fullscreen:
+	oglo->window = glfwCreateWindow(xres, yres, "attractors", glfwGetPrimaryMonitor(), NULL);
+	if(oglo->window == NULL) {
+		fprintf(stderr, "Error in glfwCreateWindow\n");
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+
+	glfwMakeContextCurrent(oglo->window);
+	glfwSetInputMode(oglo->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	// set initial cursor position
+	glfwGetCursorPos(oglo->window, &(cbVars->prevX), &(cbVars->prevY));
+
+	// vsync? 0 disabled, 1 enabled. The simulation rate does not depend on it.
+	glfwSwapInterval(vsync ? 1 : 0);
+	glfwSetFramebufferSizeCallback(oglo->window, framebufferSizeCallback);
+	glfwSetCursorPosCallback(oglo->window, mousePointerCallback);
+	glfwSetKeyCallback(oglo->window, keyCallback);
+	glfwSetWindowUserPointer(oglo->window, cbVars);
+	glViewport(0, 0, xres, yres);
+
+	if (glewInit() != GLEW_OK) {
+		fprintf(stderr, "Error, failed to initialize GLEW. Line: %d\n", __LINE__);
+		return -1;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+
+
+int setupHeadlessContext(openglObjects *oglo, const unsigned int xres, const unsigned int yres)
+{
+	oglo->window = NULL;
+#ifdef FOROSX
+	fprintf(stderr, "Error, headless OpenGL needs EGL. Use --backend cpu\n");
+	return EXIT_FAILURE;
+#else
+	// the Mesa surfaceless platform needs no X server, and works with llvmpipe or a gpu render node
+	oglo->eglDisplay = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay != NULL) {
+		oglo->eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if(oglo->eglDisplay == EGL_NO_DISPLAY) {
+		oglo->eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if(oglo->eglDisplay == EGL_NO_DISPLAY || !eglInitialize(oglo->eglDisplay, &major, &minor)) {
+		fprintf(stderr, "Error initializing EGL display\n");
+		return EXIT_FAILURE;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "Error, EGL has no desktop OpenGL support\n");
+		return EXIT_FAILURE;
+	}
+
+	// no config and no surface: everything is drawn into frameFBO
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	oglo->eglContext = eglCreateContext(oglo->eglDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+	if(oglo->eglContext == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Error in eglCreateContext: 0x%x\n", eglGetError());
+		return EXIT_FAILURE;
+	}
+	if(!eglMakeCurrent(oglo->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, oglo->eglContext)) {
+		fprintf(stderr, "Error in eglMakeCurrent: 0x%x\n", eglGetError());
+		return EXIT_FAILURE;
+	}
+	printf("Headless OpenGL: %s, %s\n", glGetString(GL_VERSION), glGetString(GL_RENDERER));
+
+	// glewInit also initializes GLX, which fails without a display. Only the GL entry points are needed.
+	glewExperimental = GL_TRUE;
+	if (glewContextInit() != GLEW_OK) {
+		fprintf(stderr, "Error, failed to initialize GLEW. Line: %d\n", __LINE__);
+		return EXIT_FAILURE;
+	}
+
+	glGenFramebuffers(1, &(oglo->frameFBO));
+	glBindFramebuffer(GL_FRAMEBUFFER, oglo->frameFBO);
+	glGenRenderbuffers(1, &(oglo->frameRBO));
+	glBindRenderbuffer(GL_RENDERBUFFER, oglo->frameRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, xres, yres);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, oglo->frameRBO);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Error, incomplete headless framebuffer\n");
+		return EXIT_FAILURE;
+	}
+	glViewport(0, 0, xres, yres);
+
+	return EXIT_SUCCESS;
+#endif
+}
+
+
+
+int setupOpenGL(openglObjects *oglo, const runOptions *opts)
+{
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+
+
+	// shaders and buffers for particles
+	const char *vertexSources[4] = {shaderVersionSource, velocityShaderSource, viewBlockSource, vertexShaderSource};
+	oglo->vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(oglo->vertexShader, 4, vertexSources, NULL);
+	glCompileShader(oglo->vertexShader);
+	int success;
+	char compileLog[OGLLOGSIZE];
+	glGetShaderiv(oglo->vertexShader, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(oglo->vertexShader, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in particles vertex shader compilation:\n%s\n", compileLog);
+	}
+
+	oglo->fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(oglo->fragmentShader, 1, &fragmentShaderSource, NULL);
+	glCompileShader(oglo->fragmentShader);
+	glGetShaderiv(oglo->fragmentShader, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(oglo->fragmentShader, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in particles fragment shader compilation:\n%s\n", compileLog);
+	}
+
+	oglo->shaderProgram = glCreateProgram();
+	glAttachShader(oglo->shaderProgram, oglo->vertexShader);
+	glAttachShader(oglo->shaderProgram, oglo->fragmentShader);
+
+	glLinkProgram(oglo->shaderProgram);
+	glGetProgramiv(oglo->shaderProgram, GL_LINK_STATUS, &success);
+	if(!success) {
+		glGetProgramInfoLog(oglo->shaderProgram, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in particles program compilation:\n%s\n", compileLog);
+	}
+	glDeleteShader(oglo->fragmentShader);
+
+	// cull program: the same vertex shader, then a geometry shader keeping the points in
+	// view. Drawing the captured points without reading their count back needs OpenGL 4.0.
+	oglo->shaderProgramCull = 0;
+	oglo->cull = 0;
+	oglo->cullVBO = 0;
+	oglo->cullTFO = 0;
+	oglo->footprint = 1.0f;
+	oglo->lodStride = 1;
+	if(GLEW_VERSION_4_0) {
+		unsigned int geometryShaderCull = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource(geometryShaderCull, 1, &geometryShaderCullSource, NULL);
+		glCompileShader(geometryShaderCull);
+		glGetShaderiv(geometryShaderCull, GL_COMPILE_STATUS, &success);
+		if(!success) {
+			glGetShaderInfoLog(geometryShaderCull, OGLLOGSIZE, NULL, compileLog);
+			fprintf(stderr, "Error in cull geometry shader compilation:\n%s\n", compileLog);
+		}
+
+		oglo->shaderProgramCull = glCreateProgram();
+		glAttachShader(oglo->shaderProgramCull, oglo->vertexShader);
+		glAttachShader(oglo->shaderProgramCull, geometryShaderCull);
+		const char *cullVaryings[2] = {"culledPos", "culledParticle"};
+		glTransformFeedbackVaryings(oglo->shaderProgramCull, 2, cullVaryings, GL_INTERLEAVED_ATTRIBS);
+		glLinkProgram(oglo->shaderProgramCull);
+		glGetProgramiv(oglo->shaderProgramCull, GL_LINK_STATUS, &success);
+		if(!success) {
+			glGetProgramInfoLog(oglo->shaderProgramCull, OGLLOGSIZE, NULL, compileLog);
+			fprintf(stderr, "Error in cull program compilation:\n%s\n", compileLog);
+		}
+		glDeleteShader(geometryShaderCull);
+		oglo->cullGroupSizeLocation = glGetUniformLocation(oglo->shaderProgramCull, "groupSize");
+		oglo->cullLodStrideLocation = glGetUniformLocation(oglo->shaderProgramCull, "lodStride");
+		glUseProgram(oglo->shaderProgramCull);
+		glUniform1i(glGetUniformLocation(oglo->shaderProgramCull, "groups"), GROUPTEXTUREUNIT);
+		glUniformBlockBinding(oglo->shaderProgramCull, glGetUniformBlockIndex(oglo->shaderProgramCull, "View"), VIEWBLOCKBINDING);
+	}
+	glDeleteShader(oglo->vertexShader);
+	glUniformBlockBinding(oglo->shaderProgram, glGetUniformBlockIndex(oglo->shaderProgram, "View"), VIEWBLOCKBINDING);
+	oglo->densityLocation = glGetUniformLocation(oglo->shaderProgram, "density");
+
+	oglo->XLocation = glGetUniformLocation(oglo->shaderProgram, "flowX");
+	oglo->YLocation = glGetUniformLocation(oglo->shaderProgram, "flowY");
+	oglo->ZLocation = glGetUniformLocation(oglo->shaderProgram, "flowZ");
+	oglo->degreeLocation = glGetUniformLocation(oglo->shaderProgram, "degree");
+	oglo->groupSizeLocation = glGetUniformLocation(oglo->shaderProgram, "groupSize");
+	oglo->trailLengthLocation = glGetUniformLocation(oglo->shaderProgram, "trailLength");
+	oglo->trailHeadLocation = glGetUniformLocation(oglo->shaderProgram, "trailHead");
+	oglo->trailParticlesLocation = glGetUniformLocation(oglo->shaderProgram, "trailParticles");
+	oglo->trailStrideDrawLocation = glGetUniformLocation(oglo->shaderProgram, "trailStride");
+	oglo->culledLocation = glGetUniformLocation(oglo->shaderProgram, "culled");
+	oglo->lodStrideLocation = glGetUniformLocation(oglo->shaderProgram, "lodStride");
+	glUseProgram(oglo->shaderProgram);
+	glUniform1i(oglo->lodStrideLocation, 1);
+	oglo->nGroups = 0;
+	oglo->groupTBO = 0;
+	oglo->groupTexture = 0;
+
+	// integration programs are compiled per flow when first used. rk45 also captures the
+	// per-particle step size, into its own buffer.
+	oglo->adaptive = (opts->integrator == INTEGRATOR_RK45);
+	oglo->tolerance = opts->tolerance;
+	oglo->nIntegrateCache = 0;
+	oglo->integrateUses = 0;
+	oglo->compute = 0;
+	oglo->workgroupSize = DEFAULTWORKGROUPSIZE;
+	oglo->maxComputeParticles = 0;
+	if(opts->compute && !GLEW_VERSION_4_3) {
+		printf("Compute shaders need OpenGL 4.3, integrating with transform feedback\n");
+	}
+	else if(opts->compute) {
+		GLint64 maxBlock = 0;
+		GLint maxInvocations = 0;
+		glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlock);
+		glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+		oglo->compute = 1;
+		// whole multiples of 1024 particles keep every dispatch's buffer offsets aligned
+		oglo->maxComputeParticles = ((size_t)maxBlock / (3*sizeof(float))) & ~(size_t)1023;
+		if(opts->workgroupSize > 0) {
+			oglo->workgroupSize = (opts->workgroupSize < (unsigned int)maxInvocations) ? opts->workgroupSize : maxInvocations;
+		}
 	}
 
-	oglo->fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(oglo->fragmentShader, 1, &fragmentShaderSource, NULL);
-	glCompileShader(oglo->fragmentShader);
-	glGetShaderiv(oglo->fragmentShader, GL_COMPILE_STATUS, &success);
+	// initialization program, a vertex shader only with no inputs
+	const char *vertexInitSources[3] = {shaderVersionSource, philoxShaderSource, vertexShaderInitSource};
+	oglo->vertexShaderInit = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(oglo->vertexShaderInit, 3, vertexInitSources, NULL);
+	glCompileShader(oglo->vertexShaderInit);
+	glGetShaderiv(oglo->vertexShaderInit, GL_COMPILE_STATUS, &success);
 	if(!success) {
-		glGetShaderInfoLog(oglo->fragmentShader, OGLLOGSIZE, NULL, compileLog);
-		fprintf(stderr, "Error in particles fragment shader compilation:\n%s\n", compileLog);
+		glGetShaderInfoLog(oglo->vertexShaderInit, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in initialization vertex shader compilation:\n%s\n", compileLog);
 	}
 
-	oglo->shaderProgram = glCreateProgram();
-	glAttachShader(oglo->shaderProgram, oglo->vertexShader);
-	glAttachShader(oglo->shaderProgram, oglo->fragmentShader);
+	oglo->shaderProgramInit = glCreateProgram();
+	glAttachShader(oglo->shaderProgramInit, oglo->vertexShaderInit);
+	const char* varyings[1] = {"posNew"};
+	glTransformFeedbackVaryings(oglo->shaderProgramInit, 1, varyings, GL_SEPARATE_ATTRIBS);
 
-	const char* varyings = "posNew";
-	glTransformFeedbackVaryings(oglo->shaderProgram, 1, &varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(oglo->shaderProgramInit);
+	glGetProgramiv(oglo->shaderProgramInit, GL_LINK_STATUS, &success);
+	if(!success) {
+		glGetProgramInfoLog(oglo->shaderProgramInit, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in initialization program compilation:\n%s\n", compileLog);
+	}
+	glDeleteShader(oglo->vertexShaderInit);
+	oglo->seedLocation = glGetUniformLocation(oglo->shaderProgramInit, "seed");
+	oglo->streamLocation = glGetUniformLocation(oglo->shaderProgramInit, "stream");
+	oglo->volSizeLocation = glGetUniformLocation(oglo->shaderProgramInit, "volSize");
+
+	// trail recording program, another vertex shader capturing positions
+	unsigned int vertexShaderTrail = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertexShaderTrail, 1, &vertexShaderTrailSource, NULL);
+	glCompileShader(vertexShaderTrail);
+	glGetShaderiv(vertexShaderTrail, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(vertexShaderTrail, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in trail vertex shader compilation:\n%s\n", compileLog);
+	}
 
-	glLinkProgram(oglo->shaderProgram);
-	glGetProgramiv(oglo->shaderProgram, GL_LINK_STATUS, &success);
+	oglo->shaderProgramTrail = glCreateProgram();
+	glAttachShader(oglo->shaderProgramTrail, vertexShaderTrail);
+	glTransformFeedbackVaryings(oglo->shaderProgramTrail, 1, varyings, GL_SEPARATE_ATTRIBS);
+	glLinkProgram(oglo->shaderProgramTrail);
+	glGetProgramiv(oglo->shaderProgramTrail, GL_LINK_STATUS, &success);
 	if(!success) {
-		glGetProgramInfoLog(oglo->shaderProgram, OGLLOGSIZE, NULL, compileLog);
-		fprintf(stderr, "Error in particles program compilation:\n%s\n", compileLog);
+		glGetProgramInfoLog(oglo->shaderProgramTrail, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in trail program compilation:\n%s\n", compileLog);
 	}
-	glDeleteShader(oglo->vertexShader);
-	glDeleteShader(oglo->fragmentShader);
-	oglo->scaleFactorLocation = glGetUniformLocation(oglo->shaderProgram, "scaleFactor");
-	oglo->translationMatrixLocation = glGetUniformLocation(oglo->shaderProgram, "translationMatrix");
-	oglo->rotationMatrixLocation = glGetUniformLocation(oglo->shaderProgram, "rotationMatrix");
-	oglo->cameraMatrixLocation = glGetUniformLocation(oglo->shaderProgram, "cameraMatrix");
-	oglo->perspectiveMatrixLocation = glGetUniformLocation(oglo->shaderProgram, "perspectiveMatrix");
-
-	oglo->XLocation = glGetUniformLocation(oglo->shaderProgram, "X");
-	oglo->YLocation = glGetUniformLocation(oglo->shaderProgram, "Y");
-	oglo->ZLocation = glGetUniformLocation(oglo->shaderProgram, "Z");
-
-	oglo->stepSizeLocation = glGetUniformLocation(oglo->shaderProgram, "stepSize");
-	oglo->updatesPerFrameLocation = glGetUniformLocation(oglo->shaderProgram, "updatesPerFrame");
+	glDeleteShader(vertexShaderTrail);
+	oglo->trailStrideLocation = glGetUniformLocation(oglo->shaderProgramTrail, "stride");
+	glUseProgram(oglo->shaderProgramTrail);
+	glUniform1i(glGetUniformLocation(oglo->shaderProgramTrail, "positions"), POSITIONTEXTUREUNIT);
+	oglo->trailVBO = 0;
+	oglo->trailTexture = 0;
+	oglo->trailLength = 0;
+	oglo->trailMemory = 0;
+	oglo->trailParticles = 0;
+	oglo->trailStride = 1;
+	oglo->trailHead = 0;
+	oglo->trailFilled = 0;
 	glUseProgram(oglo->shaderProgram);
+	glUniform1i(glGetUniformLocation(oglo->shaderProgram, "trail"), TRAILTEXTUREUNIT);
+
+	// respawning reads the integration input as a texture, and is counted where the
+	// integration shaders have atomic counters
+	glGenTextures(1, &(oglo->positionTexture));
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	oglo->maxPositions = maxTexels / 3;
+	oglo->respawnCopy = oglo->compute && opts->respawn;
+	oglo->respawnStream = 0;
+	oglo->respawnCounter = 0;
+	oglo->respawned = 0;
+	oglo->profiler = NULL;
+	GLint shaderCounters = 0;
+	if(GLEW_ARB_shader_atomic_counters) {
+		glGetIntegerv(oglo->compute ? GL_MAX_COMPUTE_ATOMIC_COUNTERS : GL_MAX_VERTEX_ATOMIC_COUNTERS, &shaderCounters);
+	}
+	if(shaderCounters > 0 && readbackInit(&(oglo->respawnRing), sizeof(unsigned int)) == EXIT_SUCCESS) {
+		const unsigned int zero = 0;
+		glGenBuffers(1, &(oglo->respawnCounter));
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, oglo->respawnCounter);
+		glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(unsigned int), &zero, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, oglo->respawnCounter);
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+	}
+
+	// the view, updated by updateTransformationUniforms and selectAttractor
+	oglo->view.rotationMatrix = glm::mat4(1.0f);
+	oglo->view.translationMatrix = glm::mat4(1.0f);
+	oglo->view.cameraMatrix = glm::mat4(1.0f);
+	oglo->view.perspectiveMatrix = glm::mat4(1.0f);
+	oglo->view.scaleFactor = 1.0f;
+	oglo->view.groupColumns = 0;
+	glGenBuffers(1, &(oglo->viewUBO));
+	glBindBuffer(GL_UNIFORM_BUFFER, oglo->viewUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(viewBlock), &(oglo->view), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, VIEWBLOCKBINDING, oglo->viewUBO);
+	oglo->viewDirty = 1;
 
 	glGenVertexArrays(1, &(oglo->VAO));
+	glGenVertexArrays(1, &(oglo->VAO2));
+	glGenVertexArrays(1, &(oglo->emptyVAO));
 	glBindVertexArray(oglo->VAO);
 
 	glGenBuffers(1, &(oglo->pos1VBO));
-	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos1VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*NPARTICLES, 0, GL_STREAM_DRAW);
-
 	glGenBuffers(1, &(oglo->pos2VBO));
-	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos2VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*NPARTICLES, 0, GL_STREAM_DRAW);
+	oglo->step1VBO = 0;
+	oglo->step2VBO = 0;
+	if(oglo->adaptive) {
+		glGenBuffers(1, &(oglo->step1VBO));
+		glGenBuffers(1, &(oglo->step2VBO));
+	}
+	setParticleFormat(oglo, opts->backend, opts->storage);
+	if(allocateParticleBuffers(oglo, opts->nParticles)) {
+		return EXIT_FAILURE;
+	}
 
 
 	// shaders and buffers for cube
+	const char *vertexCubeSources[3] = {shaderVersionSource, viewBlockSource, vertexShaderCubeSource};
 	oglo->vertexShaderCube = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(oglo->vertexShaderCube, 1, &vertexShaderCubeSource, NULL);
+	glShaderSource(oglo->vertexShaderCube, 3, vertexCubeSources, NULL);
 	glCompileShader(oglo->vertexShaderCube);
 	glGetShaderiv(oglo->vertexShaderCube, GL_COMPILE_STATUS, &success);
 	if(!success) {
@@ -585,8 +3592,7 @@ int setupOpenGL(openglObjects *oglo, callbackVariables *cbVars, const unsigned i
 	}
 	glDeleteShader(oglo->vertexShaderCube);
 	glDeleteShader(oglo->fragmentShaderCube);
-	oglo->cameraMatrixCubeLocation = glGetUniformLocation(oglo->shaderProgramCube, "cameraMatrix");
-	oglo->perspectiveMatrixCubeLocation = glGetUniformLocation(oglo->shaderProgramCube, "perspectiveMatrix");
+	glUniformBlockBinding(oglo->shaderProgramCube, glGetUniformBlockIndex(oglo->shaderProgramCube, "View"), VIEWBLOCKBINDING);
 
 	glUseProgram(oglo->shaderProgramCube);
 	glGenVertexArrays(1, &(oglo->cubeVAO));
@@ -595,6 +3601,80 @@ int setupOpenGL(openglObjects *oglo, callbackVariables *cbVars, const unsigned i
 	glGenBuffers(1, &(oglo->cubeVBO));
 	glBindBuffer(GL_ARRAY_BUFFER, oglo->cubeVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*3*24, 0, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+
+	// shader to show offscreen frames, drawing no vertex data
+	oglo->vertexShaderCopy = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(oglo->vertexShaderCopy, 1, &vertexShaderCopySource, NULL);
+	glCompileShader(oglo->vertexShaderCopy);
+	glGetShaderiv(oglo->vertexShaderCopy, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(oglo->vertexShaderCopy, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in Copy vertex shader compilation:\n%s\n", compileLog);
+	}
+
+	oglo->fragmentShaderCopy = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(oglo->fragmentShaderCopy, 1, &fragmentShaderCopySource, NULL);
+	glCompileShader(oglo->fragmentShaderCopy);
+	glGetShaderiv(oglo->fragmentShaderCopy, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(oglo->fragmentShaderCopy, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in Copy fragment shader compilation:\n%s\n", compileLog);
+	}
+
+	oglo->shaderProgramCopy = glCreateProgram();
+	glAttachShader(oglo->shaderProgramCopy, oglo->vertexShaderCopy);
+	glAttachShader(oglo->shaderProgramCopy, oglo->fragmentShaderCopy);
+	glLinkProgram(oglo->shaderProgramCopy);
+	glGetProgramiv(oglo->shaderProgramCopy, GL_LINK_STATUS, &success);
+	if(!success) {
+		glGetProgramInfoLog(oglo->shaderProgramCopy, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in Copy program compilation:\n%s\n", compileLog);
+	}
+	glDeleteShader(oglo->vertexShaderCopy);
+	glDeleteShader(oglo->fragmentShaderCopy);
+
+
+	// tone map for density rendering, in the variant for the backend's counts
+	oglo->densityFBO = 0;
+	oglo->densityTex = 0;
+	oglo->densityCounts = NULL;
+	oglo->densityFrames = 0;
+	oglo->vertexShaderToneMap = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(oglo->vertexShaderToneMap, 1, &vertexShaderCopySource, NULL);
+	glCompileShader(oglo->vertexShaderToneMap);
+	glGetShaderiv(oglo->vertexShaderToneMap, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(oglo->vertexShaderToneMap, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in ToneMap vertex shader compilation:\n%s\n", compileLog);
+	}
+
+	const char *toneMapSources[2] = {(opts->backend == BACKEND_CPU) ? toneMapCountSource : toneMapFloatSource, toneMapSource};
+	oglo->fragmentShaderToneMap = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(oglo->fragmentShaderToneMap, 2, toneMapSources, NULL);
+	glCompileShader(oglo->fragmentShaderToneMap);
+	glGetShaderiv(oglo->fragmentShaderToneMap, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(oglo->fragmentShaderToneMap, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in ToneMap fragment shader compilation:\n%s\n", compileLog);
+	}
+
+	oglo->shaderProgramToneMap = glCreateProgram();
+	glAttachShader(oglo->shaderProgramToneMap, oglo->vertexShaderToneMap);
+	glAttachShader(oglo->shaderProgramToneMap, oglo->fragmentShaderToneMap);
+	glLinkProgram(oglo->shaderProgramToneMap);
+	glGetProgramiv(oglo->shaderProgramToneMap, GL_LINK_STATUS, &success);
+	if(!success) {
+		glGetProgramInfoLog(oglo->shaderProgramToneMap, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in ToneMap program compilation:\n%s\n", compileLog);
+	}
+	glDeleteShader(oglo->vertexShaderToneMap);
+	glDeleteShader(oglo->fragmentShaderToneMap);
+	oglo->inverseReferenceLocation = glGetUniformLocation(oglo->shaderProgramToneMap, "inverseReference");
+	oglo->inverseLogPeakLocation = glGetUniformLocation(oglo->shaderProgramToneMap, "inverseLogPeak");
 
 
 	// shaders and buffers for text
@@ -635,8 +3715,293 @@ int setupOpenGL(openglObjects *oglo, callbackVariables *cbVars, const unsigned i
 
 	glGenBuffers(1, &(oglo->textVBO));
 	glBindBuffer(GL_ARRAY_BUFFER, oglo->textVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*MAXTEXTLENGTH, 0, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*6*MAXTEXTLENGTH*MAXTEXTLINES, 0, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	for(unsigned int i = 0; i < MAXTEXTLINES; i++) {
+		oglo->textLines[i][0] = '\0';
+		oglo->textPositions[i][0] = 0.0f;
+		oglo->textPositions[i][1] = 0.0f;
+		oglo->textFirst[i] = i * 6 * MAXTEXTLENGTH;
+		oglo->textCount[i] = 0;
+	}
+	// every draw binds its own vertex array, set up once
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(oglo->VAO);
+
+	return EXIT_SUCCESS;
+}
+
+
+
+void cleanupOpenGL(openglObjects *oglo)
+{
+	glDeleteVertexArrays(1, &(oglo->VAO));
+	glDeleteVertexArrays(1, &(oglo->VAO2));
+	glDeleteVertexArrays(1, &(oglo->emptyVAO));
+	glDeleteBuffers(1, &(oglo->viewUBO));
+	glDeleteBuffers(1, &(oglo->pos1VBO));
+	glDeleteBuffers(1, &(oglo->pos2VBO));
+	if(oglo->adaptive) {
+		glDeleteBuffers(1, &(oglo->step1VBO));
+		glDeleteBuffers(1, &(oglo->step2VBO));
+	}
+	glDeleteVertexArrays(1, &(oglo->cubeVAO));
+	glDeleteVertexArrays(1, &(oglo->textVAO));
+	glDeleteBuffers(1, &(oglo->textVBO));
+	glDeleteBuffers(1, &(oglo->cubeVBO));
+	glDeleteTextures(1, &(oglo->positionTexture));
+	setTrails(oglo, 0, 0);
+	glDeleteProgram(oglo->shaderProgramTrail);
+	setCulling(oglo, 0);
+	if(oglo->shaderProgramCull) glDeleteProgram(oglo->shaderProgramCull);
+	if(oglo->respawnCounter) {
+		readbackFree(&(oglo->respawnRing));
+		glDeleteBuffers(1, &(oglo->respawnCounter));
+	}
+	densityFree(oglo);
+	if(oglo->window != NULL) {
+		glfwTerminate();
+		return;
+	}
+#ifndef FOROSX
+	glDeleteFramebuffers(1, &(oglo->frameFBO));
+	glDeleteRenderbuffers(1, &(oglo->frameRBO));
+	eglMakeCurrent(oglo->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(oglo->eglDisplay, oglo->eglContext);
+	eglTerminate(oglo->eglDisplay);
+#endif
+}
+
+
+
+// (Re)allocate both ping-pong buffers for nParticles, in the format chosen by
+// setParticleFormat. Contents are undefined afterwards.
+int allocateParticleBuffers(openglObjects *oglo, size_t nParticles)
+{
+	while(glGetError() != GL_NO_ERROR);
+	size_t bytes = (oglo->halfPositions ? 3*sizeof(unsigned short) : 3*sizeof(float)) * nParticles;
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos1VBO);
+	glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos2VBO);
+	if(oglo->hostPositions || (oglo->compute && !oglo->respawnCopy)) {
+		glBufferData(GL_ARRAY_BUFFER, 0, 0, GL_STREAM_DRAW);
+	}
+	else if(oglo->compute) {
+		glBufferData(GL_ARRAY_BUFFER, respawnSources(oglo, nParticles) * 3 * sizeof(float), 0, GL_STREAM_COPY);
+	}
+	else {
+		glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_STREAM_DRAW);
+	}
+	if(oglo->adaptive && !oglo->hostPositions) {
+		// a step size of 0 makes the shader start from stepSize
+		float *zeros = (float*)calloc(nParticles, sizeof(float));
+		if(zeros == NULL) {
+			fprintf(stderr, "Error allocating %zu particles\n", nParticles);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return EXIT_FAILURE;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, oglo->step1VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float)*nParticles, zeros, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, oglo->step2VBO);
+		glBufferData(GL_ARRAY_BUFFER, oglo->compute ? 0 : sizeof(float)*nParticles, zeros, GL_STREAM_DRAW);
+		free(zeros);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(glGetError() == GL_OUT_OF_MEMORY) {
+		fprintf(stderr, "Error, out of memory allocating buffers for %zu particles\n", nParticles);
+		return EXIT_FAILURE;
+	}
+	oglo->nParticles = nParticles;
+	pointParticleArrays(oglo);
+	return EXIT_SUCCESS;
+}
+
+
+
+// Point VAO at the first buffer of each pair and VAO2 at the second, in the format of
+// setParticleFormat
+void pointParticleArrays(openglObjects *oglo)
+{
+	const unsigned int arrays[2] = {oglo->VAO, oglo->VAO2};
+	const unsigned int positions[2] = {oglo->pos1VBO, oglo->pos2VBO};
+	const unsigned int steps[2] = {oglo->step1VBO, oglo->step2VBO};
+	for(unsigned int i = 0; i < 2; i++) {
+		glBindVertexArray(arrays[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, positions[i]);
+		if(oglo->halfPositions) {
+			glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, 3 * sizeof(unsigned short), (void*)0);
+		}
+		else {
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		}
+		glEnableVertexAttribArray(0);
+		if(oglo->adaptive && !oglo->hostPositions) {
+			glBindBuffer(GL_ARRAY_BUFFER, steps[i]);
+			glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+			glEnableVertexAttribArray(1);
+		}
+		else {
+			glDisableVertexAttribArray(1);
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+
+// Particle attributes from the current buffers, and with capture set the other buffers
+// of each pair as transform feedback outputs
+void bindParticleBuffers(openglObjects *oglo, unsigned int capture)
+{
+	glBindVertexArray(oglo->VAO);
+	if(capture) {
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, oglo->pos2VBO);
+		if(oglo->adaptive) glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, oglo->step2VBO);
+	}
+}
+
+
+
+// The gpu backend keeps its state in the buffers, always in float. The cpu backend only
+// uploads a copy to draw, optionally as half floats to halve the transfer.
+void setParticleFormat(openglObjects *oglo, unsigned int backend, unsigned int storage)
+{
+	oglo->hostPositions = (backend == BACKEND_CPU);
+	oglo->halfPositions = (backend == BACKEND_CPU && storage == STORAGE_HALF);
+}
+
+
+
+// Place particles first to nParticles-1 uniformly at random in [-volSize,volSize]^3, where
+// the state lives: on the cpu threads, or by the initialization shader without a host copy.
+// Positions depend only on seed, stream and the particle index, and are the same on both backends.
+void randomizeParticles(openglObjects *oglo, unsigned int backend, cpuIntegrator *cpu, size_t first, float volSize, unsigned int seed, unsigned int stream)
+{
+	oglo->densityFrames = 0;
+	oglo->trailFilled = 0;
+	if(first >= oglo->nParticles) return;
+	if(backend == BACKEND_CPU) {
+		cpuIntegratorRandomPositions(cpu, first, volSize, seed, stream);
+		uploadCpuPositions(oglo, cpu);
+		return;
+	}
+
+	glUseProgram(oglo->shaderProgramInit);
+	glUniform1ui(oglo->seedLocation, seed);
+	glUniform1ui(oglo->streamLocation, stream);
+	glUniform1f(oglo->volSizeLocation, volSize);
+	// nothing is read, so nothing may be sourced from the buffer being written
+	glBindVertexArray(oglo->emptyVAO);
+	glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, oglo->pos1VBO, first * 3 * sizeof(float),
+		(oglo->nParticles - first) * 3 * sizeof(float));
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, first, oglo->nParticles - first);
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+}
+
+
+
+// Write the cpu backend state straight into the render copy, converting and interleaving
+// on the integrator's threads
+void uploadCpuPositions(openglObjects *oglo, cpuIntegrator *cpu)
+{
+	size_t bytes = (oglo->halfPositions ? 3*sizeof(unsigned short) : 3*sizeof(float)) * oglo->nParticles;
+	glBindBuffer(GL_ARRAY_BUFFER, oglo->pos1VBO);
+	void *dst = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(dst == NULL) {
+		fprintf(stderr, "Error mapping particle buffer for upload\n");
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+	if(oglo->halfPositions) {
+		cpuIntegratorGetPositionsHalf(cpu, (unsigned short*)dst);
+	}
+	else {
+		cpuIntegratorGetPositions(cpu, (float*)dst);
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 
+
+// swap buffers 1 and 2 of each pair: output becomes input
+void swapParticleBuffers(openglObjects *oglo)
+{
+	unsigned int tmp = oglo->pos1VBO;
+	oglo->pos1VBO = oglo->pos2VBO;
+	oglo->pos2VBO = tmp;
+	tmp = oglo->step1VBO;
+	oglo->step1VBO = oglo->step2VBO;
+	oglo->step2VBO = tmp;
+	tmp = oglo->VAO;
+	oglo->VAO = oglo->VAO2;
+	oglo->VAO2 = tmp;
+}
+
+
+
+// Change the number of particles, keeping the current state of those which remain.
+// Added particles start where a reset to the default volume with this stream would have
+// put them. On failure nothing changes.
+int resizeParticles(openglObjects *oglo, runOptions *opts, cpuIntegrator *cpu, size_t nParticles, unsigned int stream)
+{
+	size_t nKept = (nParticles < oglo->nParticles) ? nParticles : oglo->nParticles;
+
+	// new ping-pong pair; the gpu state is copied across without a round trip through the host
+	unsigned int oldVBO[4] = {oglo->pos1VBO, oglo->pos2VBO, oglo->step1VBO, oglo->step2VBO};
+	size_t oldNParticles = oglo->nParticles;
+	glGenBuffers(1, &(oglo->pos1VBO));
+	glGenBuffers(1, &(oglo->pos2VBO));
+	if(oglo->adaptive) {
+		glGenBuffers(1, &(oglo->step1VBO));
+		glGenBuffers(1, &(oglo->step2VBO));
+	}
+	if(allocateParticleBuffers(oglo, nParticles) || (opts->backend == BACKEND_CPU && cpuIntegratorResize(cpu, nParticles))) {
+		glDeleteBuffers(1, &(oglo->pos1VBO));
+		glDeleteBuffers(1, &(oglo->pos2VBO));
+		if(oglo->adaptive) {
+			glDeleteBuffers(1, &(oglo->step1VBO));
+			glDeleteBuffers(1, &(oglo->step2VBO));
+		}
+		oglo->pos1VBO = oldVBO[0];
+		oglo->pos2VBO = oldVBO[1];
+		oglo->step1VBO = oldVBO[2];
+		oglo->step2VBO = oldVBO[3];
+		oglo->nParticles = oldNParticles;
+		pointParticleArrays(oglo);
+		return EXIT_FAILURE;
+	}
+	if(opts->backend == BACKEND_GPU) {
+		glBindBuffer(GL_COPY_READ_BUFFER, oldVBO[0]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, oglo->pos1VBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, nKept * 3 * sizeof(float));
+		if(oglo->adaptive) {
+			// new particles keep the zero step size from allocation
+			glBindBuffer(GL_COPY_READ_BUFFER, oldVBO[2]);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, oglo->step1VBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, nKept * sizeof(float));
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	glDeleteBuffers(oglo->adaptive ? 4 : 2, oldVBO);
+	if(opts->backend == BACKEND_CPU) {
+		// the integrator kept its particles, but the new render copy needs a full upload
+		cpuIntegratorRandomPositions(cpu, nKept, opts->volSize, opts->seed, stream);
+		uploadCpuPositions(oglo, cpu);
+	}
+	else {
+		randomizeParticles(oglo, BACKEND_GPU, cpu, nKept, opts->volSize, opts->seed, stream);
+	}
+	oglo->densityFrames = 0;
+	// the trails sample the new particles
+	if(oglo->trailLength > 0) setTrails(oglo, oglo->trailLength, oglo->trailMemory);
+	if(oglo->cull) setCulling(oglo, 1);
+	printf("Particles: %zu\n", nParticles);
 	return EXIT_SUCCESS;
 }
 
@@ -677,72 +4042,319 @@ void mousePointerCallback(GLFWwindow* window, double xpos, double ypos)
 
 
 
-void initializeParticlePositions(float *pos, const float volSize)
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	(void)scancode;
+	(void)mods;
+	callbackVariables *cbVars = (callbackVariables*)glfwGetWindowUserPointer(window);
+	if(key < 0 || key > GLFW_KEY_LAST) return;
+	if(action == GLFW_PRESS) {
+		cbVars->held[key] = 1;
+		if(cbVars->nPressed < MAXKEYPRESSES) cbVars->pressed[cbVars->nPressed++] = key;
+	}
+	else if(action == GLFW_RELEASE) {
+		cbVars->held[key] = 0;
+	}
+}
+
+
+
+void setAttractorParameters(openglObjects *oglo, const attractorParameters *params)
+{
+	oglo->densityFrames = 0;
+	// update values in shader
+	glUseProgram(oglo->shaderProgram);
+	glUniform1fv(oglo->XLocation, NPARAMETERS, params->X);
+	glUniform1fv(oglo->YLocation, NPARAMETERS, params->Y);
+	glUniform1fv(oglo->ZLocation, NPARAMETERS, params->Z);
+	glUniform1i(oglo->degreeLocation, params->degree);
+}
+
+
+
+// velocity() with only the non-zero terms, as literal constants, summed in the same order
+// as velocityShaderSource. For an ensemble, loadFlow() fetches those terms of each
+// particle's group into k instead.
+void specializeVelocitySource(const attractorParameters *params, unsigned int ensemble, char *source, size_t size)
 {
-	for(size_t i = 0; i < NPARTICLES; i++) {
-		pos[3*i+0] = 2.0f * volSize * (rand()/(float)RAND_MAX-0.5f);
-		pos[3*i+1] = 2.0f * volSize * (rand()/(float)RAND_MAX-0.5f);
-		pos[3*i+2] = 2.0f * volSize * (rand()/(float)RAND_MAX-0.5f);
+	const float *coefficients[3] = {params->X, params->Y, params->Z};
+	size_t n;
+	if(ensemble) {
+		n = snprintf(source, size, "uniform int groupSize;\nuniform samplerBuffer groups;\nfloat k[%u];\n"
+			"void loadFlow()\n{\n\tint base = %u*(PARTICLEID / groupSize);\n", 3*NPARAMETERS, GROUPFLOATS);
+		for(unsigned int j = 0; j < 3*NPARAMETERS && n < size; j++) {
+			if(coefficients[j / NPARAMETERS][j % NPARAMETERS] == 0.0f) continue;
+			n += snprintf(source+n, size-n, "\tk[%u] = texelFetch(groups, base + %u).r;\n", j, j);
+		}
+	}
+	else {
+		n = snprintf(source, size, "uniform int groupSize;\nvoid loadFlow()\n{\n");
+	}
+	if(n < size) n += snprintf(source+n, size-n, "}\n\nvec3 velocity(vec3 p)\n{\n\tfloat x = p.x;\n\tfloat y = p.y;\n\tfloat z = p.z;\n\treturn vec3(");
+	for(int c = 0; c < 3 && n < size; c++) {
+		n += snprintf(source+n, size-n, "\n\t\t");
+		// quadratic terms, then the cubic ones summed apart
+		unsigned int nTerms = 0, nCubic = 0;
+		for(unsigned int i = 0; i < NPARAMETERS && n < size; i++) {
+			if(coefficients[c][i] == 0.0f) continue;
+			const char *separator = (nTerms + nCubic == 0) ? "" : " + ";
+			if(i >= NQUADRATIC && nCubic++ == 0 && nTerms > 0) separator = " + (";
+			else if(i < NQUADRATIC) nTerms++;
+			if(ensemble) n += snprintf(source+n, size-n, "%sk[%u]%s", separator, c*NPARAMETERS + i, monomialSources[i]);
+			else n += snprintf(source+n, size-n, "%s%.9e%s", separator, coefficients[c][i], monomialSources[i]);
+		}
+		if(n < size) n += snprintf(source+n, size-n, "%s%s%s", (nTerms + nCubic == 0) ? "0.0" : "",
+			(nTerms > 0 && nCubic > 0) ? ")" : "", (c < 2) ? "," : "");
 	}
+	if(n >= size) return;
+	snprintf(source+n, size-n, ");\n}\n");
 }
 
 
 
-void setAttractorParameters(openglObjects *oglo, unsigned int attractor)
+// Make the integration program of params, or of the ensemble, current, compiling it if it is
+// not cached
+const integrateProgram *useIntegrateProgram(openglObjects *oglo, const attractorParameters *params)
 {
-	float X[NPARAMETERS];
-	float Y[NPARAMETERS];
-	float Z[NPARAMETERS];
+	oglo->integrateUses++;
+	unsigned int ensemble = (oglo->nGroups > 0);
+	if(ensemble) params = &(oglo->groupPattern);
+	unsigned int workgroupSize = oglo->compute ? oglo->workgroupSize : 0;
+	integrateProgram *ip = NULL;
+	for(unsigned int i = 0; i < oglo->nIntegrateCache; i++) {
+		if(oglo->integrateCache[i].ensemble == ensemble && oglo->integrateCache[i].workgroupSize == workgroupSize
+			&& !memcmp(&(oglo->integrateCache[i].params), params, sizeof(attractorParameters))) {
+			ip = &(oglo->integrateCache[i]);
+			ip->lastUsed = oglo->integrateUses;
+			glUseProgram(ip->program);
+			return ip;
+		}
+	}
 
-	// initialize all to zero
-	for(size_t i = 0; i < NPARAMETERS; i++) {
-		X[i] = 0.0f;
-		Y[i] = 0.0f;
-		Z[i] = 0.0f;
+	if(oglo->nIntegrateCache < INTEGRATECACHESIZE) {
+		ip = &(oglo->integrateCache[oglo->nIntegrateCache++]);
+	}
+	else {
+		ip = &(oglo->integrateCache[0]);
+		for(unsigned int i = 1; i < INTEGRATECACHESIZE; i++) {
+			if(oglo->integrateCache[i].lastUsed < ip->lastUsed) ip = &(oglo->integrateCache[i]);
+		}
+		glDeleteProgram(ip->program);
 	}
 
-	// now set non-zero parameters of each attractor
-	switch(attractor) {
-		// Lorenz
-		case 1:
-			X[1] = -10.0f;
-			X[2] = 10.0f;
-			Y[1] = 28.0f;
-			Y[2] = -1.0f;
-			Y[6] = -1.0f;
-			Z[3] = -8.0f/3.0f;
-			Z[5] = 1.0f;
-			break;
-		// Roessler
-		case 2:
-			X[2] = -1.0f;
-			X[3] = -1.0f;
-			Y[1] = 1.0f;
-			Y[2] = 0.1f;
-			Z[0] = 0.1f;
-			Z[3] = -14.0f;
-			Z[6] = 1.0f;
-			break;
-		// Lu Chen
-		case 3:
-			X[1] = -36.0f;
-			X[2] = 36.0f;
-			Y[0] = 7.0f;
-			Y[1] = 1.0f;
-			Y[2] = 20.0f;
-			Y[6] = -1.0f;
-			Z[3] = -3.0f;
-			Z[5] = 1.0f;
-			break;
-		default:
-			printf("Error, unrecognised attractor %u\n", attractor);
+	char velocitySource[VELOCITYSOURCELENGTH];
+	specializeVelocitySource(params, ensemble, velocitySource, VELOCITYSOURCELENGTH);
+	// how the particle is found, and the optional parts of the shader
+	char preludeSource[PRELUDESOURCELENGTH];
+	size_t n = snprintf(preludeSource, sizeof(preludeSource), "%s",
+		oglo->respawnCounter ? "#extension GL_ARB_shader_atomic_counters : require\n#define COUNTRESPAWNS\n" : "");
+	if(workgroupSize > 0) {
+		snprintf(preludeSource+n, sizeof(preludeSource)-n, "layout (local_size_x = %u) in;\nuniform int first;\nuniform int count;\n"
+			"#define PARTICLEINDEX int((gl_WorkGroupID.y*gl_NumWorkGroups.x + gl_WorkGroupID.x)*gl_WorkGroupSize.x + gl_LocalInvocationID.x)\n"
+			"#define PARTICLEID (first + PARTICLEINDEX)\n%s", workgroupSize, oglo->adaptive ? "#define ADAPTIVE\n" : "");
+	}
+	else {
+		snprintf(preludeSource+n, sizeof(preludeSource)-n, "#define PARTICLEID gl_VertexID\n");
+	}
+	const char *sources[6] = {(workgroupSize > 0) ? computeVersionSource : shaderVersionSource, preludeSource, philoxShaderSource,
+		velocitySource, integrateShaderSource, (workgroupSize > 0) ? computeIntegrateSource : vertexIntegrateSource};
+	int success;
+	char compileLog[OGLLOGSIZE];
+	unsigned int shader = glCreateShader((workgroupSize > 0) ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER);
+	glShaderSource(shader, 6, sources, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if(!success) {
+		glGetShaderInfoLog(shader, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in integration %s shader compilation:\n%s\n", (workgroupSize > 0) ? "compute" : "vertex", compileLog);
 	}
 
-	// update values in shader
+	ip->program = glCreateProgram();
+	glAttachShader(ip->program, shader);
+	if(workgroupSize == 0) {
+		const char* varyings[2] = {"posNew", "stepNew"};
+		glTransformFeedbackVaryings(ip->program, oglo->adaptive ? 2 : 1, varyings, GL_SEPARATE_ATTRIBS);
+	}
+	glLinkProgram(ip->program);
+	glGetProgramiv(ip->program, GL_LINK_STATUS, &success);
+	if(!success) {
+		glGetProgramInfoLog(ip->program, OGLLOGSIZE, NULL, compileLog);
+		fprintf(stderr, "Error in integration program compilation:\n%s\n", compileLog);
+	}
+	glDeleteShader(shader);
+
+	ip->params = *params;
+	ip->ensemble = ensemble;
+	ip->workgroupSize = workgroupSize;
+	ip->firstLocation = glGetUniformLocation(ip->program, "first");
+	ip->countLocation = glGetUniformLocation(ip->program, "count");
+	ip->lastUsed = oglo->integrateUses;
+	ip->groupSizeLocation = glGetUniformLocation(ip->program, "groupSize");
+	ip->stepSizeLocation = glGetUniformLocation(ip->program, "stepSize");
+	ip->updatesPerFrameLocation = glGetUniformLocation(ip->program, "updatesPerFrame");
+	ip->integratorLocation = glGetUniformLocation(ip->program, "integrator");
+	ip->boundLocation = glGetUniformLocation(ip->program, "bound");
+	ip->volSizeLocation = glGetUniformLocation(ip->program, "volSize");
+	ip->seedLocation = glGetUniformLocation(ip->program, "seed");
+	ip->respawnStreamLocation = glGetUniformLocation(ip->program, "respawnStream");
+	ip->nPositionsLocation = glGetUniformLocation(ip->program, "nPositions");
+	glUseProgram(ip->program);
+	glUniform1f(glGetUniformLocation(ip->program, "tolerance"), oglo->tolerance);
+	glUniform1i(glGetUniformLocation(ip->program, "groups"), GROUPTEXTUREUNIT);
+	glUniform1i(glGetUniformLocation(ip->program, "positions"), POSITIONTEXTUREUNIT);
+	return ip;
+}
+
+
+
+// The first particles a respawn may copy, as many as positionTexture can address
+size_t respawnSources(const openglObjects *oglo, size_t nParticles)
+{
+	return (nParticles < (size_t)oglo->maxPositions) ? nParticles : (size_t)oglo->maxPositions;
+}
+
+
+
+// Per pass uniforms of the current integration program, for nParticles particles taking
+// nSteps steps, and the input positions as positionTexture for respawning
+void setIntegrateUniforms(openglObjects *oglo, const integrateProgram *ip, const runOptions *opts, size_t nParticles, int nSteps)
+{
+	glUniform1i(ip->groupSizeLocation, ensembleGroupSize(oglo));
+	glUniform1f(ip->stepSizeLocation, opts->stepSize);
+	glUniform1i(ip->updatesPerFrameLocation, nSteps);
+	glUniform1i(ip->integratorLocation, opts->integrator);
+	glUniform1f(ip->boundLocation, opts->respawn ? RESPAWNBOUND * opts->volSize : 0.0f);
+	glUniform1f(ip->volSizeLocation, opts->volSize);
+	glUniform1ui(ip->seedLocation, opts->seed);
+	glUniform1ui(ip->respawnStreamLocation, oglo->respawnStream++);
+	glUniform1i(ip->nPositionsLocation, (int)respawnSources(oglo, nParticles));
+	unsigned int input = oglo->pos1VBO;
+	if(oglo->respawnCopy) {
+		// otherwise a respawn could copy a particle already moved in this pass, depending on
+		// the order the invocations run in
+		glBindBuffer(GL_COPY_READ_BUFFER, oglo->pos1VBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, oglo->pos2VBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, respawnSources(oglo, nParticles) * 3 * sizeof(float));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		input = oglo->pos2VBO;
+	}
+	glActiveTexture(GL_TEXTURE0 + POSITIONTEXTUREUNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, oglo->positionTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, input);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+
+
+static void respawnCount(void *arg, const void *data, size_t bytes, unsigned long long tag)
+{
+	(void)bytes;
+	(void)tag;
+	((openglObjects*)arg)->respawned = *(const unsigned int*)data;
+}
+
+
+
+// Pick up the respawn count of an earlier pass and ask for the latest, without waiting.
+// wait blocks until the latest has arrived.
+void respawnPoll(openglObjects *oglo, unsigned int wait)
+{
+	if(oglo->respawnCounter == 0) return;
+	readbackPoll(&(oglo->respawnRing), respawnCount, oglo);
+	readbackRequest(&(oglo->respawnRing), oglo->respawnCounter, sizeof(unsigned int), 0);
+	if(wait) readbackFlush(&(oglo->respawnRing), respawnCount, oglo);
+}
+
+
+
+// Give every attractor of library an equal share of the particles, drawn in a grid with
+// the view of each relative to reference, the one selected
+int setEnsemble(openglObjects *oglo, unsigned int backend, cpuIntegrator *cpu, const attractorLibrary *library, const attractorDefinition *reference)
+{
+	const unsigned int nGroups = library->n;
+	float *groupData = (float*)malloc(nGroups * GROUPFLOATS * sizeof(float));
+	attractorParameters *groups = (attractorParameters*)malloc(nGroups * sizeof(attractorParameters));
+	if(groupData == NULL || groups == NULL) {
+		fprintf(stderr, "Error allocating an ensemble of %u attractors\n", nGroups);
+		free(groupData);
+		free(groups);
+		return EXIT_FAILURE;
+	}
+
+	memset(&(oglo->groupPattern), 0, sizeof(attractorParameters));
+	for(unsigned int g = 0; g < nGroups; g++) {
+		const attractorDefinition *def = &(library->attractors[g]);
+		groups[g] = def->params;
+		float *d = &(groupData[g*GROUPFLOATS]);
+		memcpy(d, def->params.X, NPARAMETERS*sizeof(float));
+		memcpy(d + NPARAMETERS, def->params.Y, NPARAMETERS*sizeof(float));
+		memcpy(d + 2*NPARAMETERS, def->params.Z, NPARAMETERS*sizeof(float));
+		d[3*NPARAMETERS] = def->scaleFactor / reference->scaleFactor;
+		memcpy(d + 3*NPARAMETERS + 1, def->translation, 3*sizeof(float));
+		for(unsigned int i = 0; i < NPARAMETERS; i++) {
+			if(def->params.X[i] != 0.0f) oglo->groupPattern.X[i] = 1.0f;
+			if(def->params.Y[i] != 0.0f) oglo->groupPattern.Y[i] = 1.0f;
+			if(def->params.Z[i] != 0.0f) oglo->groupPattern.Z[i] = 1.0f;
+		}
+		if(def->params.degree > oglo->groupPattern.degree) oglo->groupPattern.degree = def->params.degree;
+	}
+	int status = (backend == BACKEND_CPU) ? cpuIntegratorSetGroups(cpu, groups, nGroups) : EXIT_SUCCESS;
+	free(groups);
+	if(status) {
+		free(groupData);
+		return EXIT_FAILURE;
+	}
+
+	if(oglo->groupTBO == 0) {
+		glGenBuffers(1, &(oglo->groupTBO));
+		glGenTextures(1, &(oglo->groupTexture));
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, oglo->groupTBO);
+	glBufferData(GL_TEXTURE_BUFFER, nGroups * GROUPFLOATS * sizeof(float), groupData, GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	free(groupData);
+	glActiveTexture(GL_TEXTURE0 + GROUPTEXTUREUNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, oglo->groupTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, oglo->groupTBO);
+	glActiveTexture(GL_TEXTURE0);
+
+	oglo->nGroups = nGroups;
+	oglo->groupColumns = (unsigned int)ceil(sqrt((double)nGroups));
 	glUseProgram(oglo->shaderProgram);
-	glUniform1fv(oglo->XLocation, NPARAMETERS, X);
-	glUniform1fv(oglo->YLocation, NPARAMETERS, Y);
-	glUniform1fv(oglo->ZLocation, NPARAMETERS, Z);
+	glUniform1i(glGetUniformLocation(oglo->shaderProgram, "groups"), GROUPTEXTUREUNIT);
+	oglo->view.groupColumns = oglo->groupColumns;
+	oglo->viewDirty = 1;
+	// the render program evaluates the cubic terms if any group has them
+	glUniform1i(oglo->degreeLocation, oglo->groupPattern.degree);
+	oglo->densityFrames = 0;
+	printf("Ensemble: %u flows of %d particles\n", nGroups, ensembleGroupSize(oglo));
+	return EXIT_SUCCESS;
+}
+
+
+
+// Particles per group of the ensemble, 0 without one
+int ensembleGroupSize(const openglObjects *oglo)
+{
+	return (oglo->nGroups > 0) ? (int)cpuIntegratorGroupSize(oglo->nParticles, oglo->nGroups) : 0;
+}
+
+
+
+// Switch to the flow and view of def. The step size follows the attractor unless the user chose one.
+void selectAttractor(openglObjects *oglo, runOptions *opts, const attractorDefinition *def, attractorParameters *params, float userStepSize)
+{
+	*params = def->params;
+	setAttractorParameters(oglo, params);
+
+	oglo->view.scaleFactor = def->scaleFactor;
+	// translation to move points relative to cube -- centre the attractor
+	oglo->view.translationMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(def->translation[0], def->translation[1], def->translation[2]));
+	oglo->viewDirty = 1;
+
+	opts->volSize = def->volSize;
+	if(userStepSize == 0.0f) opts->stepSize = (def->stepSize > 0.0f) ? def->stepSize : DEFAULTSTEPSIZE;
 }
 
 
@@ -786,6 +4398,7 @@ void prepareCubeVertices(openglObjects *oglo)
 
 void updateTransformationUniforms(openglObjects *oglo, callbackVariables *cbVars, float theta, float phi, unsigned int xres, unsigned int yres, glm::vec3 cameraPosition)
 {
+	oglo->densityFrames = 0;
 	// rotation matrix, rotate by theta w.r.t. x axis and phi w.r.t. t axis:
 	glm::mat4 rotationMatrix = glm::mat4(1.0f);
 	rotationMatrix = glm::rotate(rotationMatrix, theta, glm::vec3(1.0f, 0.0f, 0.0f));
@@ -799,14 +4412,43 @@ void updateTransformationUniforms(openglObjects *oglo, callbackVariables *cbVars
 	// perspective transformation: fov, aspect ratio, near plane, far plane
 	glm::mat4 perspectiveMatrix = glm::perspective(45.0f, (float)xres/(float)yres, 0.0f, 100.0f);
 
-	// set uniforms in both vertex shaders
-	glUseProgram(oglo->shaderProgramCube);
-	glUniformMatrix4fv(oglo->cameraMatrixCubeLocation, 1, GL_FALSE, glm::value_ptr(cameraMatrix));
-	glUniformMatrix4fv(oglo->perspectiveMatrixCubeLocation, 1, GL_FALSE, glm::value_ptr(perspectiveMatrix));
-	glUseProgram(oglo->shaderProgram);
-	glUniformMatrix4fv(oglo->rotationMatrixLocation, 1, GL_FALSE, glm::value_ptr(rotationMatrix));
-	glUniformMatrix4fv(oglo->cameraMatrixLocation, 1, GL_FALSE, glm::value_ptr(cameraMatrix));
-	glUniformMatrix4fv(oglo->perspectiveMatrixLocation, 1, GL_FALSE, glm::value_ptr(perspectiveMatrix));
+	// pixels the cube covers, which the particles mostly fill, or all of them if the camera is
+	// inside it
+	glm::mat4 projection = perspectiveMatrix * cameraMatrix;
+	float left = 1.0f, right = -1.0f, bottom = 1.0f, top = -1.0f;
+	unsigned int inside = 0;
+	for(unsigned int i = 0; i < 8; i++) {
+		glm::vec4 c = projection * glm::vec4((i & 1) ? CUBESIZE : -CUBESIZE, (i & 2) ? CUBESIZE : -CUBESIZE, (i & 4) ? CUBESIZE : -CUBESIZE, 1.0f);
+		if(c.w <= 0.0f) inside = 1;
+		left = fminf(left, c.x/c.w);
+		right = fmaxf(right, c.x/c.w);
+		bottom = fminf(bottom, c.y/c.w);
+		top = fmaxf(top, c.y/c.w);
+	}
+	left = fmaxf(left, -1.0f);
+	right = fminf(right, 1.0f);
+	bottom = fmaxf(bottom, -1.0f);
+	top = fminf(top, 1.0f);
+	oglo->footprint = (float)xres * yres;
+	if(!inside) oglo->footprint *= (right > left && top > bottom) ? 0.25f * (right - left) * (top - bottom) : 0.0f;
+
+	// every program reads these from the view block, uploaded once before the next draw
+	oglo->view.rotationMatrix = rotationMatrix;
+	oglo->view.cameraMatrix = cameraMatrix;
+	oglo->view.perspectiveMatrix = perspectiveMatrix;
+	oglo->viewDirty = 1;
+}
+
+
+
+// Upload the view block if it changed since the last upload
+void uploadView(openglObjects *oglo)
+{
+	if(!oglo->viewDirty) return;
+	glBindBuffer(GL_UNIFORM_BUFFER, oglo->viewUBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(viewBlock), &(oglo->view));
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	oglo->viewDirty = 0;
 }
 
 
@@ -865,12 +4507,41 @@ void ftLoadGlyphs(openglObjects *oglo, FT_Face ftFace, glyphInfo *glyphs)
 
 
 
-void renderText(openglObjects *oglo, glyphInfo *glyphs, std::string text, float posx, float posy, int xres, int yres)
+// A heading, a line per phase and one for the whole frame, min/mean/p99 ms over the profiler window
+unsigned int formatProfile(const frameProfiler *profiler, char strings[][MAXTEXTLENGTH])
+{
+	unsigned int n = 0;
+	sprintf(strings[n++], "ms         cpu min / mean / p99        gpu min / mean / p99");
+	for(unsigned int phase = 0; phase <= profiler->nPhases; phase++) {
+		profilerStats cpuStats, gpuStats;
+		if(!frameProfilerStats(profiler, phase, 0, &cpuStats)) break;
+		int length = sprintf(strings[n], "%-10s %6.3f %6.3f %6.3f", (phase < profiler->nPhases) ? profiler->names[phase] : "frame",
+			cpuStats.min, cpuStats.mean, cpuStats.p99);
+		if(frameProfilerStats(profiler, phase, 1, &gpuStats)) {
+			sprintf(strings[n] + length, "      %6.3f %6.3f %6.3f", gpuStats.min, gpuStats.mean, gpuStats.p99);
+		}
+		n++;
+	}
+	return n;
+}
+
+
+
+// Lay out text as a quad per glyph, starting at (posx,posy) in normalized device coordinates,
+// into its line of textVBO. An unchanged line costs a string comparison.
+void setText(openglObjects *oglo, const glyphInfo *glyphs, unsigned int line, const char *text, float posx, float posy, int xres, int yres)
 {
-	unsigned int nCharacters = text.length();
-	float *vertices = (float*)malloc(4 * 6 * nCharacters * sizeof(float));
+	if(oglo->textPositions[line][0] == posx && oglo->textPositions[line][1] == posy
+		&& strncmp(oglo->textLines[line], text, MAXTEXTLENGTH) == 0) return;
+	strncpy(oglo->textLines[line], text, MAXTEXTLENGTH-1);
+	oglo->textLines[line][MAXTEXTLENGTH-1] = '\0';
+	oglo->textPositions[line][0] = posx;
+	oglo->textPositions[line][1] = posy;
+
+	unsigned int nCharacters = strlen(oglo->textLines[line]);
+	float vertices[4 * 6 * MAXTEXTLENGTH];
 	for(unsigned int i = 0; i < nCharacters; i++) {
-		size_t index = (size_t)text[i];
+		size_t index = (size_t)text[i] & 127;
 		float scalex = 1.0f/2048.0f;
 		float scaley = scalex * (float)xres/(float(yres));
 		float x = posx + glyphs[index].left * scalex;
@@ -910,15 +4581,20 @@ void renderText(openglObjects *oglo, glyphInfo *glyphs, std::string text, float
 		posx += glyphs[index].advancex * scalex;
 	}
 
-	glUseProgram(oglo->shaderProgramText);
+	oglo->textCount[line] = 6*nCharacters;
+	if(nCharacters == 0) return;
 	glBindBuffer(GL_ARRAY_BUFFER, oglo->textVBO);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, oglo->fontTex);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float)*4*6*nCharacters, vertices);
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(float)*4*oglo->textFirst[line], sizeof(float)*4*6*nCharacters, vertices);
+}
 
-	glDrawArrays(GL_TRIANGLES, 0, 6*nCharacters);
 
-	free(vertices);
+
+// Every non-empty line in one draw
+void drawText(openglObjects *oglo)
+{
+	glUseProgram(oglo->shaderProgramText);
+	glBindVertexArray(oglo->textVAO);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, oglo->fontTex);
+	glMultiDrawArrays(GL_TRIANGLES, oglo->textFirst, oglo->textCount, MAXTEXTLINES);
 }